@@ -1,10 +1,92 @@
 import numpy as np
 from stat_util import get_best_distribution
 import scipy.stats as st
+from instrumentation import timed
+
+def l2_error(x):
+    return np.linalg.norm(x,ord=2,axis=1)
+
+def is_sliceable(X):
+    return hasattr(X,'shape') and hasattr(X,'__getitem__')
+
+def is_row_list(X):
+    '''
+    True for a list or tuple of rows (or of scalars), which is one matrix rather than a sequence of chunks
+    '''
+    if not isinstance(X,(list,tuple)) or len(X) == 0:
+        return False
+    first = X[0]
+    if not isinstance(first,(list,tuple)) and np.ndim(first) == 0:
+        return True
+    #A row holds scalars, a chunk holds rows and an (X_chunk, y_chunk) pair holds a chunk first
+    return len(first) > 0 and np.ndim(first[0]) == 0
+
+'''
+Yields X (and y) in blocks of at most block_size rows.
+X is either an array (also np.memmap), sliced without copying the rest of it,
+or an iterable of chunks which are arrays, or (X_chunk, y_chunk) pairs when y is None
+'''
+def iter_blocks(X,y=None,block_size=65536):
+    if is_row_list(X):
+        X = np.asarray(X)
+    if is_sliceable(X):
+        for start in range(0,len(X),block_size):
+            X_block = np.asarray(X[start:start+block_size])
+            yield X_block if y is None else (X_block,np.asarray(y[start:start+block_size]))
+        return
+    for chunk in X:
+        if y is None and isinstance(chunk,tuple):
+            X_chunk,y_chunk = chunk
+            for block in iter_blocks(X_chunk,y_chunk,block_size):
+                yield block
+        elif y is None:
+            for block in iter_blocks(chunk,None,block_size):
+                yield block
+        else:
+            raise ValueError("pass chunked labels inside the chunks as (X_chunk, y_chunk) pairs")
+
+class Reservoir:
+
+    '''
+    Uniform random sample of at most size of all rows added so far (reservoir sampling)
+    '''
+    def __init__(self,size,random_state=None):
+        self.size = size
+        self.rng = np.random.RandomState(random_state)
+        self.rows = None
+        self.seen = 0
+
+    def add(self,rows):
+        rows = np.asarray(rows)
+        if len(rows) == 0:
+            return
+        if self.rows is None:
+            self.rows = np.empty((0,)+rows.shape[1:],dtype=rows.dtype)
+        free = min(self.size-len(self.rows),len(rows))
+        if free > 0:
+            self.rows = np.concatenate([self.rows,rows[:free]])
+        #Row number t replaces a random slot with probability size/t, later rows overwrite earlier ones
+        t = self.seen+np.arange(free,len(rows))+1
+        slots = (self.rng.random_sample(len(t))*t).astype(np.int64)
+        keep = slots < self.size
+        self.rows[slots[keep]] = rows[free:][keep]
+        self.seen += len(rows)
 
 class REPD:
     
-    def __init__(self,dim_reduction_model,error_func=lambda x: np.linalg.norm(x,ord=2,axis=1)):
+    '''
+    error_func - applied to the reconstruction difference; when None, a dimension reduction model
+    exposing reconstruction_error(X) computes the error itself (fused), otherwise the L2 norm is used
+    fast_predict - when True, fit precomputes the error intervals where dd outweighs dnd and
+    predict labels rows with a searchsorted over those boundaries instead of evaluating both pdfs
+    distribution_options - keyword arguments for stat_util.get_best_distribution (dist_names, workers, screen_size, ...)
+    block_size - rows pushed through the dim reduction model at once, bounds the memory of fit and predict
+    reservoir_size - training rows of each class kept for partial_fit to recompute errors and refit dnd/dd
+    drift_threshold - Kolmogorov-Smirnov distance between the current errors and a fitted distribution
+    above which partial_fit refits that distribution
+    '''
+    def __init__(self,dim_reduction_model,error_func=None,fast_predict=False,distribution_options=None,block_size=65536,
+                 reservoir_size=10000,drift_threshold=0.1):
         self.dim_reduction_model = dim_reduction_model
         
         self.dnd = None #Distribution non defect
@@ -14,54 +96,246 @@ class REPD:
         self.dd_pa = None#Distribution defect parameters
 
         self.error_func = error_func
+
+        self.fast_predict = fast_predict
+        self.distribution_options = distribution_options or {}
+        self.boundaries = None#Sorted errors at which the predicted label changes
+        self.interval_labels = None#Label of each interval between boundaries
+
+        self.block_size = block_size
+
+        self.reservoir_size = reservoir_size
+        self.drift_threshold = drift_threshold
+        self.nd_reservoir = None#Sample of the non-defective training rows
+        self.d_reservoir = None#Sample of the defective training rows
+        self.drift = None#KS distances measured by the last partial_fit
         
     '''
     X should be a N*M matrix of data instances
     y should be a binary vector where 1 indicates a defect instance and 0 a normal instance 
+    X may also be a list of rows, an np.memmap, or with y=None a re-iterable of (X_chunk, y_chunk) pairs.
+    A dim reduction model with fit_blocks (AutoEncoder) then trains from one block at a time,
+    other models are given the non-defective rows as one array.
     '''
-    def fit(self,X,y):
-        #Prepare data
-        X_nd = X[y==0]
-        X_d = X[y==1]
+    @timed('repd.fit',rows_of=1)
+    def fit(self,X,y=None):
+        if is_row_list(X):
+            X = np.asarray(X)
+        if not is_sliceable(X) and iter(X) is X:
+            raise ValueError("fit reads the chunks more than once, pass a re-iterable instead of an iterator")
+        if is_sliceable(X) and not isinstance(X,np.memmap) or not hasattr(self.dim_reduction_model,'fit_blocks'):
+            #Dim reduction model initialization
+            X_nd = np.concatenate([X_block[y_block==0] for X_block,y_block in iter_blocks(X,y,self.block_size)])
+            self.dim_reduction_model.fit(X_nd)
+            del X_nd
+        else:
+            self.dim_reduction_model.fit_blocks(lambda: (X_block[y_block==0] for X_block,y_block in iter_blocks(X,y,self.block_size)))
 
-        #Dim reduction model initialization
-        self.dim_reduction_model.fit(X_nd)
-        
-        #Caclculate reconstruction errors for train defective and train non-defective
-        nd_errors = self.calculate_reconstruction_error(X_nd)
-        d_errors = self.calculate_reconstruction_error(X_d)
+        self.fit_distributions(X,y)
+
+    '''
+    Fits dnd and dd on the reconstruction errors of an already trained dim reduction model
+    '''
+    @timed('repd.fit_distributions',rows_of=1)
+    def fit_distributions(self,X,y=None):
+        #Caclculate reconstruction errors for train defective and train non-defective, one block at a time
+        nd_errors = []
+        d_errors = []
+        self.nd_reservoir = Reservoir(self.reservoir_size)
+        self.d_reservoir = Reservoir(self.reservoir_size)
+        for X_block,y_block in iter_blocks(X,y,self.block_size):
+            errors = self.__block_errors__(X_block)
+            nd_errors.append(errors[y_block==0])
+            d_errors.append(errors[y_block==1])
+            self.nd_reservoir.add(X_block[y_block==0])
+            self.d_reservoir.add(X_block[y_block==1])
+        nd_errors = np.concatenate(nd_errors)
+        d_errors = np.concatenate(d_errors)
         
         #Determine distribution
-        best_distribution_nd = get_best_distribution(nd_errors)
-        best_distribution_d = get_best_distribution(d_errors)
+        self.dnd, self.dnd_pa = self.__best_distribution__(nd_errors)
+        self.dd, self.dd_pa = self.__best_distribution__(d_errors)
 
-        #Initialize distributions
-        self.dnd = getattr(st, best_distribution_nd[0])
-        self.dnd_pa = best_distribution_nd[1]
-        
-        self.dd = getattr(st, best_distribution_d[0])
-        self.dd_pa = best_distribution_d[1]
-        
-    def predict(self,X):
-        #Test model performance
-        test_errors = self.calculate_reconstruction_error(X)
+        self.__update_decision_index__(np.concatenate([nd_errors,d_errors]))
+
+    @timed('repd.best_distribution',rows_of=1)
+    def __best_distribution__(self,errors):
+        best_distribution = get_best_distribution(errors,**self.distribution_options)
+        return getattr(st, best_distribution[0]), best_distribution[1]
+
+    def __update_decision_index__(self,train_errors):
+        self.boundaries = None
+        self.interval_labels = None
+        if self.fast_predict:
+            self.build_decision_index(train_errors)
+            #Fall back to the exact path if the index disagrees on any training error
+            if self.decision_index_mismatches(train_errors) > 0:
+                self.boundaries = None
+                self.interval_labels = None
+
+    '''
+    Updates a fitted model with a new labelled batch instead of refitting from scratch.
+    A dim reduction model with partial_fit (AutoEncoder) continues training on the new non-defective
+    rows for epochs passes; the new rows are merged into the reservoirs, and dnd and dd are only refit,
+    on the reservoir errors, when those errors drifted more than drift_threshold away from them.
+    A model loaded with repd_artifact.load_repd keeps its reservoirs, but its default NumpyAutoEncoder
+    cannot train: load it with model_factory=autoencoder_from_artifact, or pass epochs=0 to only
+    update the reservoirs and distributions.
+    '''
+    @timed('repd.partial_fit',rows_of=1)
+    def partial_fit(self,X,y,epochs=1):
+        if self.dnd is None:
+            self.fit(X,y)
+            return self
+        if self.nd_reservoir is None or self.d_reservoir is None:
+            raise ValueError("partial_fit needs the training reservoirs, this model was saved without them; refit it with fit")
+        X = np.asarray(X)
+        y = np.asarray(y)
+
+        X_nd = X[y==0]
+        if len(X_nd) > 0 and epochs > 0:
+            if not hasattr(self.dim_reduction_model,'partial_fit'):
+                raise ValueError(type(self.dim_reduction_model).__name__+" cannot continue training, "
+                                 "load the model with autoencoder_from_artifact or pass epochs=0")
+            self.dim_reduction_model.partial_fit(X_nd,epochs=epochs)
+        self.nd_reservoir.add(X_nd)
+        self.d_reservoir.add(X[y==1])
+
+        #Errors of the sampled rows under the current model weights
+        nd_errors = self.calculate_reconstruction_error(self.nd_reservoir.rows)
+        d_errors = self.calculate_reconstruction_error(self.d_reservoir.rows)
+        self.drift = {
+            'nd': float(st.kstest(nd_errors,self.dnd.cdf,args=self.dnd_pa).statistic),
+            'd': float(st.kstest(d_errors,self.dd.cdf,args=self.dd_pa).statistic)
+        }
+
+        refit = False
+        if self.drift['nd'] > self.drift_threshold:
+            self.dnd, self.dnd_pa = self.__best_distribution__(nd_errors)
+            refit = True
+        if self.drift['d'] > self.drift_threshold:
+            self.dd, self.dd_pa = self.__best_distribution__(d_errors)
+            refit = True
+        if refit:
+            self.__update_decision_index__(np.concatenate([nd_errors,d_errors]))
+        return self
         
+    '''
+    X may be an array, an np.memmap or an iterable of chunks.
+    out - optional preallocated (e.g. memory-mapped) output the labels are written to block by block
+    '''
+    def predict(self,X,out=None):
+        return self.__collect__(self.iter_predict(X),out)
+
+    '''
+    Yields the labels of X block by block, for writing predictions of inputs larger than memory
+    '''
+    def iter_predict(self,X):
+        for X_block in iter_blocks(X,None,self.block_size):
+            yield self.__block_labels__(self.__block_errors__(X_block))
+
+    @timed('repd.labels',rows_of=1)
+    def __block_labels__(self,test_errors):
+        if self.boundaries is not None:
+            return self.get_indexed_labels(test_errors)
+        return self.get_exact_labels(test_errors)
+
+    def __collect__(self,blocks,out):
+        if out is None:
+            blocks = list(blocks)
+            return np.concatenate(blocks) if blocks else np.zeros(0)
+        start = 0
+        for block in blocks:
+            out[start:start+len(block)] = block
+            start += len(block)
+        return out
+
+    def get_exact_labels(self,errors):
+        p_nd = self.get_non_defect_probability(errors)
+        p_d = self.get_defect_probability(errors)
+        return np.where(p_nd >= p_d,0,1)
+
+    def get_indexed_labels(self,errors):
+        return self.interval_labels[np.searchsorted(self.boundaries,errors,side='right')]
+
+    '''
+    Solves once for the errors where the label of dnd vs dd changes.
+    errors - sample errors (usually the training errors) that are always part of the search grid,
+    the grid is extended with grid_size evenly spaced points over their range and a geometric tail
+    '''
+    @timed('repd.decision_index',rows_of=1)
+    def build_decision_index(self,errors,grid_size=4096,bisection_steps=64):
+        errors = np.asarray(errors,dtype=np.float64)
+        lo = min(0.0,float(np.min(errors)))
+        hi = max(float(np.max(errors)),1e-12)
+        grid = np.unique(np.concatenate([
+            errors,
+            np.linspace(lo,hi,grid_size),
+            np.geomspace(hi,hi*1e4,grid_size//16)
+        ]))
+        labels = self.get_exact_labels(grid)
+
+        #Bisect every grid cell in which the label flips, all cells at once
+        flips = np.flatnonzero(labels[1:] != labels[:-1])
+        left = grid[flips]
+        right = grid[flips+1]
+        left_label = labels[flips]
+        for _ in range(bisection_steps):
+            middle = (left+right)/2
+            same = self.get_exact_labels(middle) == left_label
+            left = np.where(same,middle,left)
+            right = np.where(same,right,middle)
+
+        self.boundaries = right
+        self.interval_labels = np.concatenate([labels[:1],labels[flips+1]])
+
+    '''
+    Number of errors whose indexed label differs from the exact pdf comparison
+    '''
+    def decision_index_mismatches(self,errors):
+        return int(np.sum(self.get_indexed_labels(errors) != self.get_exact_labels(errors)))
+
+    '''
+    Returns the posterior defect probability p_d/(p_nd+p_d) of every row of X.
+    Values above 0.5 are exactly the rows predict labels as defective.
+    X and out as in predict
+    '''
+    def predict_defect_probability(self,X,out=None):
+        return self.__collect__(self.iter_predict_defect_probability(X),out)
+
+    def iter_predict_defect_probability(self,X):
+        for X_block in iter_blocks(X,None,self.block_size):
+            yield self.__block_probability__(self.__block_errors__(X_block))
+
+    def __block_probability__(self,test_errors):
         p_nd = self.get_non_defect_probability(test_errors)
         p_d = self.get_defect_probability(test_errors)
-        
-        return np.asarray([0 if p_nd[i] >= p_d[i]  else 1 for i in range(len(X))])
-    
+
+        with np.errstate(divide='ignore',invalid='ignore'):
+            probability = p_d/(p_nd+p_d)
+        return np.nan_to_num(probability)
+
     def get_non_defect_probability(self,errors):
         return self.__get_data_probability__(errors,self.dnd,self.dnd_pa)
     
     def get_defect_probability(self,errors):
         return self.__get_data_probability__(errors,self.dd,self.dd_pa)
     
+    '''
+    Reconstruction errors of X (array, np.memmap or iterable of chunks), computed block by block
+    '''
     def calculate_reconstruction_error(self,X):
+        return self.__collect__((self.__block_errors__(X_block) for X_block in iter_blocks(X,None,self.block_size)),None)
+
+    @timed('repd.reconstruction_error',rows_of=1)
+    def __block_errors__(self,X):
+        if self.error_func is None and hasattr(self.dim_reduction_model,'reconstruction_error'):
+            return self.dim_reduction_model.reconstruction_error(X)
+        error_func = l2_error if self.error_func is None else self.error_func
         t = self.dim_reduction_model.transform(X)
         r = self.dim_reduction_model.inverse_transform(t)
         x_diff = r-X
-        return self.error_func(x_diff)
+        return error_func(x_diff)
     
     def get_probability_data(self):
         example_errors = np.linspace(0,3000,100)
@@ -69,18 +343,7 @@ class REPD:
         d_p = self.get_defect_probability(example_errors)
         return example_errors,nd_p,d_p
         
+    @timed('repd.pdf',rows_of=1)
     def __get_data_probability__(self,data,distribution,distribution_parameteres):
-        parameter_count = len(distribution_parameteres)
-        probability = None
-        if parameter_count==1:
-            probability = distribution.pdf(data,distribution_parameteres[0])
-        elif parameter_count==2:
-            probability = distribution.pdf(data,distribution_parameteres[0],distribution_parameteres[1])
-        elif parameter_count==3:
-            probability = distribution.pdf(data,distribution_parameteres[0],distribution_parameteres[1],distribution_parameteres[2])
-        elif parameter_count==4:
-            probability = distribution.pdf(data,distribution_parameteres[0],distribution_parameteres[1],distribution_parameteres[2],distribution_parameteres[3])
-        elif parameter_count==5:
-            probability = distribution.pdf(data,distribution_parameteres[0],distribution_parameteres[1],distribution_parameteres[2],distribution_parameteres[3],distribution_parameteres[4])
-        return probability
+        return distribution.pdf(data,*distribution_parameteres)
         
@@ -1,61 +1,117 @@
-from imblearn.over_sampling import SMOTE
+import numpy as np
+from joblib import Parallel, delayed
+from sklearn.base import clone
+from sklearn.neighbors import NearestNeighbors
 from sklearn.tree import DecisionTreeClassifier
 from sklearn.ensemble import AdaBoostClassifier
 from sklearn.ensemble import BaggingClassifier
 from sklearn.ensemble import RandomForestClassifier
-from sklearn.model_selection import train_test_split
+from sklearn.model_selection import StratifiedKFold
 from sklearn.metrics import f1_score
+from thread_budget import sklearn_jobs
+
+class SmoteNeighbours:
+
+    '''
+    SMOTE over-sampling whose minority nearest neighbours are computed once on the full data.
+    Resampling a subset of the rows (a cross-validation fold) only uses neighbours inside that subset,
+    resampling all rows is plain SMOTE with k_neighbors neighbours.
+    '''
+    def __init__(self, X, y, k_neighbors=5, random_state=None):
+        self.rng = np.random.RandomState(random_state)
+        labels, counts = np.unique(y, return_counts=True)
+        self.minority_label = labels[np.argmin(counts)]
+        self.k_neighbors = k_neighbors
+
+        self.minority = np.flatnonzero(y==self.minority_label)
+        # extra neighbours so that folds still find k of them among their own rows
+        neighbour_count = min(2*k_neighbors+1, len(self.minority))
+        nn = NearestNeighbors(n_neighbors=neighbour_count).fit(X[self.minority])
+        self.neighbours = nn.kneighbors(X[self.minority], return_distance=False)[:,1:]
+
+    def resample(self, X, y, rows=None):
+        if rows is None:
+            rows = np.arange(len(y))
+        in_rows = np.zeros(len(y), dtype=bool)
+        in_rows[rows] = True
+
+        minority_in_rows = in_rows[self.minority]
+        base = np.flatnonzero(minority_in_rows)
+        needed = (len(rows)-len(base))-len(base)
+        if needed <= 0 or len(base) == 0:
+            return X[rows], y[rows]
+
+        #Choose a random one of the first k neighbours that are part of rows
+        base = base[self.rng.randint(len(base), size=needed)]
+        if self.neighbours.shape[1] == 0:
+            return X[rows], y[rows]
+        valid = minority_in_rows[self.neighbours[base]]
+        rank = np.cumsum(valid, axis=1)
+        valid &= rank <= self.k_neighbors
+        counts = valid.sum(axis=1)
+        choice = (self.rng.rand(needed)*counts).astype(int)+1
+        column = np.argmax(valid & (rank == choice[:,None]), axis=1)
+        #Rows without neighbours in the subset are duplicated
+        neighbour = np.where(counts > 0, self.neighbours[base, column], base)
+
+        x_base = X[self.minority[base]]
+        x_neighbour = X[self.minority[neighbour]]
+        synthetic = x_base + self.rng.rand(needed, 1)*(x_neighbour-x_base)
+
+        X_res = np.concatenate([X[rows], synthetic])
+        y_res = np.concatenate([y[rows], np.full(needed, self.minority_label, dtype=np.asarray(y).dtype)])
+        return X_res, y_res
+
+def _score_fold(model, X, y, smote, train, test):
+    X_train, y_train = smote.resample(X, y, train)
+    model.fit(X_train, y_train)
+    return f1_score(y[test], model.predict(X[test]))
 
 class SmoteEnsemble:
-    
-    def __init__(self):
-        #
-        self.smote = SMOTE()
+
+    '''
+    n_splits - folds used to score every candidate model
+    n_jobs - processes scoring the (candidate, fold) pairs concurrently and training the final model,
+    None uses the thread budget of thread_budget (all cores without one)
+    '''
+    def __init__(self, n_splits=3, n_jobs=None, random_state=None):
+        self.n_splits = n_splits
+        self.n_jobs = sklearn_jobs() if n_jobs is None else n_jobs
+        self.random_state = random_state
         self.models = [
             ("Ada",AdaBoostClassifier()),
             ("Bagging",BaggingClassifier(base_estimator=DecisionTreeClassifier())),
             ("RandomForest",RandomForestClassifier())
         ]
         self.model=None
-    
-    def fit(self,X,y,test_size=0.2):
+        self.scores=None
+
+    def fit(self,X,y):
         if self.model is None:
-	
-            #Determine best performing model
-            best = ""
-            best_f1 = -1
-            #
-            X_train, X_test, y_train, y_test = train_test_split(X, y, test_size=test_size)
-            #
-            for name, model in self.models:
-                model.fit(X_train,y_train)
-                #
-                y_pred = model.predict(X_test)
-                #
-                f1 = f1_score(y_test,y_pred)
-                #
-                if f1>best_f1:
-                    best_f1 = f1
-                    best = name
-                    
-            #SMOTE Train data
-            X, y = self.smote.fit_resample(X,y)
-            
-            #Train the best model
-            model = None
-            if best=="Ada":
-                model = AdaBoostClassifier()
-            elif best=="Bagging":
-                model = BaggingClassifier(base_estimator=DecisionTreeClassifier())
-            elif best=="RandomForest":
-                model = RandomForestClassifier()
-            #
+            X = np.asarray(X)
+            y = np.asarray(y)
+            smote = SmoteNeighbours(X, y, random_state=self.random_state)
+
+            #Determine best performing model by mean k-fold F1 on SMOTE resampled training folds
+            folds = list(StratifiedKFold(n_splits=self.n_splits, shuffle=True, random_state=self.random_state).split(X, y))
+            jobs = [(name, model, train, test) for name, model in self.models for train, test in folds]
+            f1s = Parallel(n_jobs=self.n_jobs)(delayed(_score_fold)(clone(model), X, y, smote, train, test) for _, model, train, test in jobs)
+
+            self.scores = {name: float(np.mean([f1 for (job_name, _, _, _), f1 in zip(jobs, f1s) if job_name == name])) for name, _ in self.models}
+            best = max(self.models, key=lambda item: self.scores[item[0]])
+
+            #Train the best model on SMOTE data, reusing the neighbours of the fold scoring
+            X, y = smote.resample(X, y)
+            model = clone(best[1])
+            if 'n_jobs' in model.get_params():
+                model.set_params(n_jobs=self.n_jobs)
             model.fit(X,y)
-            
+
             #Store trained model
             self.model = model
         else:
+            #Later fits reuse the selected model
             self.model.fit(X,y)
-    
+
     def predict(self,X):
         return self.model.predict(X)
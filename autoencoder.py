@@ -7,16 +7,23 @@ Created on Thu Apr 19 14:06:01 2018
 """
 
 import os
+import time
 #
+import numpy as np
 import tensorflow.compat.v1 as tf
 tf.disable_v2_behavior()
 import math
 #
 from general_utility import canTFUseGPU
+from instrumentation import stage, timed
+from thread_budget import session_config
+
+def l2_norm(x):
+    return tf.norm(x,axis=1)
 
 class AutoEncoder:
     
-    def __init__(self, layers, lr=0.01, epoch=200, batch_size=512, transfer_function=tf.nn.relu, error_func = lambda x: tf.norm(x,axis=1), print_device=False):
+    def __init__(self, layers, lr=0.01, epoch=200, batch_size=512, transfer_function=tf.nn.relu, error_func=l2_norm, print_device=False):
         device = '/cpu:0'
         if canTFUseGPU():
             if print_device:
@@ -28,9 +35,20 @@ class AutoEncoder:
             self.lr = lr
             self.epoch = epoch
             self.batch_size = batch_size
+            self.transfer_function = transfer_function
+            self.error_func = error_func
      
+            # Training input pipeline: the data is handed to the graph once per fit and
+            # streamed as shuffled, prefetched batches; feeding self.x bypasses it
+            with tf.device('/cpu:0'):
+                self.train_data = tf.placeholder("float", [None, self.layers[0]])
+                self.shuffle_buffer = tf.placeholder(tf.int64, [])
+                dataset = tf.data.Dataset.from_tensor_slices(self.train_data)
+                dataset = dataset.shuffle(self.shuffle_buffer, reshuffle_each_iteration=True)
+                dataset = dataset.batch(self.batch_size).repeat().prefetch(1)
+                self.iterator = tf.data.make_initializable_iterator(dataset)
             #      
-            self.x = tf.placeholder("float", [None, self.layers[0]])
+            self.x = tf.placeholder_with_default(self.iterator.get_next(), [None, self.layers[0]])
             #
             self.W = []
             #
@@ -77,7 +95,8 @@ class AutoEncoder:
             self.reduced = self.h[-1]
             
             # Objective functions
-            self.meansq = tf.reduce_mean(error_func(self.x-self.g[0]))
+            self.errors = error_func(self.x-self.g[0])#Per instance reconstruction error
+            self.meansq = tf.reduce_mean(self.errors)
             self.train_step = tf.train.AdamOptimizer(self.lr).minimize(self.meansq)
             
             #Decoder only
@@ -99,32 +118,130 @@ class AutoEncoder:
                 self.d.append(di)
             self.d = list(reversed(self.d))
             
-            self.sess = tf.Session()
+            self.sess = tf.Session(config=session_config())
             init = tf.global_variables_initializer()
             self.sess.run(init)
         
         
-    def fit(self,X,print_progress=False):
+    @timed('autoencoder.fit',rows_of=1)
+    def fit(self,X,print_progress=False,validation_split=0.0,patience=None,min_delta=0.0,shuffle=True,epochs=None):
+        '''
+        Trains for at most self.epoch epochs (or epochs), continuing from the current weights.
+        validation_split - fraction of X held out to measure the reconstruction loss after every epoch
+        patience - with a validation split, stop after this many epochs without an improvement
+        larger than min_delta and restore the best weights
+        The per epoch log (epoch, seconds, loss, val_loss) is kept in self.history
+        '''
+        X = np.asarray(X, dtype=np.float32)
+        X_val = None
+        if validation_split > 0:
+            permutation = np.random.permutation(len(X))
+            val_count = max(1,int(len(X)*validation_split))
+            X_val = X[permutation[:val_count]]
+            X = X[permutation[val_count:]]
+
         batch_count = math.ceil(len(X)/self.batch_size)
-        for i in range(self.epoch):
-            for j in range(batch_count):
-                #creating batch
-                start_index = j*self.batch_size
-                end_index = (j+1)*self.batch_size
-                batch = X[start_index:end_index]
-                #train
-                self.sess.run(self.train_step, feed_dict={self.x: batch})
+        self.sess.run(self.iterator.initializer, feed_dict={self.train_data: X, self.shuffle_buffer: max(len(X),1) if shuffle else 1})
+
+        self.history = []
+        best_loss = math.inf
+        best_weights = None
+        waited = 0
+        for i in range(self.epoch if epochs is None else epochs):
+            start = time.perf_counter()
+            loss = 0.0
+            with stage('autoencoder.epoch',rows=len(X)):
+                for j in range(batch_count):
+                    #train on the next batch of the pipeline
+                    _, batch_loss = self.sess.run([self.train_step, self.meansq])
+                    loss += batch_loss
+            entry = {'epoch': i, 'loss': loss/max(batch_count,1)}
+            if X_val is not None:
+                entry['val_loss'] = float(self.sess.run(self.meansq, feed_dict={self.x: X_val}))
+            entry['seconds'] = time.perf_counter()-start
+            self.history.append(entry)
+
             if print_progress:
-                print(i,"Error:",self.sess.run(self.meansq, feed_dict={self.x: X}))
+                print(i,"Error:",entry['loss'],"Validation error:",entry.get('val_loss'),"Time:",entry['seconds'])
+
+            if X_val is not None and patience is not None:
+                if entry['val_loss'] < best_loss-min_delta:
+                    best_loss = entry['val_loss']
+                    best_weights = self.get_weights()
+                    waited = 0
+                else:
+                    waited += 1
+                    if waited >= patience:
+                        break
+
+        if best_weights is not None:
+            self.set_weights(*best_weights)
         return self
     
+    def partial_fit(self,X,epochs=1):
+        '''
+        Continues training the current weights on new rows for a few epochs
+        '''
+        return self.fit(X,epochs=epochs)
+
+    @timed('autoencoder.fit_blocks')
+    def fit_blocks(self,blocks,print_progress=False,shuffle=True):
+        '''
+        Trains for self.epoch epochs on data that does not fit in memory at once.
+        blocks - callable returning a fresh iterable of row blocks for every epoch,
+        the blocks go through the shuffled input pipeline one after another
+        '''
+        self.history = []
+        for i in range(self.epoch):
+            start = time.perf_counter()
+            loss = 0.0
+            batch_count = 0
+            for block in blocks():
+                block = np.asarray(block, dtype=np.float32)
+                if len(block) == 0:
+                    continue
+                with stage('autoencoder.block',rows=len(block),bytes=block.nbytes):
+                    self.sess.run(self.iterator.initializer, feed_dict={self.train_data: block, self.shuffle_buffer: len(block) if shuffle else 1})
+                    for j in range(math.ceil(len(block)/self.batch_size)):
+                        _, batch_loss = self.sess.run([self.train_step, self.meansq])
+                        loss += batch_loss
+                        batch_count += 1
+            entry = {'epoch': i, 'loss': loss/max(batch_count,1), 'seconds': time.perf_counter()-start}
+            self.history.append(entry)
+
+            if print_progress:
+                print(i,"Error:",entry['loss'],"Time:",entry['seconds'])
+        return self
+
+    @timed('autoencoder.transform',rows_of=1)
     def transform(self,X):
         return self.sess.run(self.reduced,feed_dict={self.x: X})
     
+    @timed('autoencoder.inverse_transform',rows_of=1)
     def inverse_transform(self,X):
         it = self.sess.run(self.d[0],feed_dict={self.y: X})
         return it;
+
+    @timed('autoencoder.reconstruction_error',rows_of=1)
+    def reconstruction_error(self,X):
+        '''
+        Per row reconstruction error of X under the configured error_func,
+        evaluated in a single session call instead of transform + inverse_transform
+        '''
+        return self.sess.run(self.errors,feed_dict={self.x: X})
     
+    def get_weights(self):
+        '''
+        Returns the encoder weights W, encoder biases b and decoder biases c as lists of numpy arrays
+        '''
+        return self.sess.run([self.W, self.b, self.c])
+
+    def set_weights(self,W,b,c):
+        for variables, values in ((self.W,W),(self.b,b),(self.c,c)):
+            for variable, value in zip(variables, values):
+                variable.load(value, self.sess)
+        return self
+
     def fit_transform(self,X):
         self.fit(X)
         self.transform(X)
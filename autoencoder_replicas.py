@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Trains many independent AutoEncoder replicas in a single graph.
+
+Every variable carries a leading replica axis and the layers are batched
+matmuls, so one sess.run steps all replicas at once. The replicas share no
+parameters and the loss is a sum of per-replica losses, so each replica
+receives exactly the gradients it would get when trained alone. The Adam
+moments and step counts are kept per replica as well, and a replica whose
+data is exhausted for the epoch is not updated, so replicas of different
+dataset sizes train like separate AutoEncoder.fit runs.
+"""
+import math
+
+import numpy as np
+import tensorflow.compat.v1 as tf
+tf.disable_v2_behavior()
+
+from autoencoder import l2_norm
+from numpy_autoencoder import NumpyAutoEncoder
+from REPD_Impl import REPD
+from thread_budget import session_config
+
+class AutoEncoderReplicas:
+
+    def __init__(self, replicas, layers, lr=0.01, epoch=200, batch_size=512, transfer_function=tf.nn.relu, error_func=l2_norm):
+        self.replicas = replicas
+        self.layers = layers
+        self.lr = lr
+        self.epoch = epoch
+        self.batch_size = batch_size
+        self.transfer_function = transfer_function
+
+        self.graph = tf.Graph()
+        with self.graph.as_default():
+            #Replica, instance, feature
+            self.x = tf.placeholder("float", [replicas, None, self.layers[0]])
+            #1 for real rows, 0 for padding of replicas whose batch is short
+            self.mask = tf.placeholder("float", [replicas, None])
+
+            self.W = []
+            self.b = []
+            self.c = []
+
+            h = self.x
+            for i in range(len(self.layers)-1):
+                limit = 1.0 / math.sqrt(self.layers[i])
+                Wi = tf.Variable(tf.random_uniform((replicas, self.layers[i], self.layers[i+1]), -limit, limit))
+                self.W.append(Wi)
+                bi = tf.Variable(tf.zeros([replicas, 1, self.layers[i+1]]))
+                self.b.append(bi)
+                h = transfer_function(tf.matmul(h,Wi) + bi)
+
+            self.c = [tf.Variable(tf.zeros([replicas, 1, self.layers[i]])) for i in range(len(self.layers)-1)]
+            g = h
+            for i in reversed(range(len(self.layers)-1)):
+                g = tf.matmul(g,self.W[i],transpose_b=True) + self.c[i]
+                if i == len(self.layers)-2 or i != 0:
+                    g = transfer_function(g)
+
+            #Per instance errors through the same error_func as AutoEncoder, of the real rows only: padding
+            #reconstructs to exactly zero at first and the gradient of the norm at zero is NaN
+            real = self.mask > 0
+            errors = error_func(tf.boolean_mask(self.x-g, real))
+            replica_ids = tf.boolean_mask(tf.tile(tf.range(replicas)[:,None], [1,tf.shape(self.mask)[1]]), real)
+            row_count = tf.maximum(tf.reduce_sum(self.mask,axis=1),1.0)
+            self.replica_loss = tf.unsorted_segment_sum(errors, replica_ids, replicas)/row_count
+            self.train_step = self.__adam_step__(tf.reduce_sum(self.replica_loss))
+
+            self.sess = tf.Session(graph=self.graph, config=session_config())
+            self.sess.run(tf.global_variables_initializer())
+
+    '''
+    Adam (as tf.train.AdamOptimizer) with moments and a step count per replica. Replicas without rows in
+    the batch are left untouched, so every replica is stepped exactly as AutoEncoder.fit steps a model
+    trained on its data alone, however many batches the other replicas have.
+    '''
+    def __adam_step__(self, loss, beta1=0.9, beta2=0.999, epsilon=1e-8):
+        params = self.W+self.b+self.c
+        gradients = tf.gradients(loss, params)
+        active = tf.cast(tf.reduce_sum(self.mask,axis=1) > 0, tf.float32)
+        steps = tf.Variable(tf.zeros([self.replicas]))
+        new_steps = steps+active
+        #Bias corrected step size per replica, inactive replicas with no step yet get a finite dummy
+        t = tf.maximum(new_steps,1.0)
+        lr_t = tf.reshape(self.lr*tf.sqrt(1-tf.pow(beta2,t))/(1-tf.pow(beta1,t)), [self.replicas,1,1])
+        a = tf.reshape(active, [self.replicas,1,1])
+
+        updates = [tf.assign(steps,new_steps)]
+        for param, gradient in zip(params, gradients):
+            m = tf.Variable(tf.zeros_like(param.initial_value))
+            v = tf.Variable(tf.zeros_like(param.initial_value))
+            new_m = m+a*(1-beta1)*(gradient-m)
+            new_v = v+a*(1-beta2)*(tf.square(gradient)-v)
+            updates.append(tf.assign(m,new_m))
+            updates.append(tf.assign(v,new_v))
+            updates.append(tf.assign_sub(param,a*lr_t*new_m/(tf.sqrt(new_v)+epsilon)))
+        return tf.group(*updates)
+
+    '''
+    datasets - one training matrix per replica, e.g. the non-defective rows of each episode's train split
+    Every replica walks its own shuffled data in batches; replicas with fewer batches are skipped
+    (no weight, moment or step count change) for the remaining steps of the epoch.
+    '''
+    def fit(self, datasets, print_progress=False):
+        if len(datasets) != self.replicas:
+            raise ValueError("expected "+str(self.replicas)+" datasets, got "+str(len(datasets)))
+        datasets = [np.asarray(X, dtype=np.float32) for X in datasets]
+        steps = math.ceil(max(len(X) for X in datasets)/self.batch_size)
+
+        batch = np.zeros((self.replicas, self.batch_size, self.layers[0]), dtype=np.float32)
+        mask = np.zeros((self.replicas, self.batch_size), dtype=np.float32)
+        for i in range(self.epoch):
+            permutations = [np.random.permutation(len(X)) for X in datasets]
+            loss = np.zeros(self.replicas)
+            for j in range(steps):
+                mask[:] = 0
+                for r, X in enumerate(datasets):
+                    rows = X[permutations[r][j*self.batch_size:(j+1)*self.batch_size]]
+                    batch[r,:len(rows)] = rows
+                    mask[r,:len(rows)] = 1
+                _, batch_loss = self.sess.run([self.train_step, self.replica_loss], feed_dict={self.x: batch, self.mask: mask})
+                loss += batch_loss
+            if print_progress:
+                print(i,"Error:",loss/steps)
+        return self
+
+    def get_models(self):
+        '''
+        Returns one NumpyAutoEncoder per replica
+        '''
+        W, b, c = self.sess.run([self.W, self.b, self.c])
+        return [NumpyAutoEncoder(self.layers, [Wi[r] for Wi in W], [bi[r,0] for bi in b], [ci[r,0] for ci in c], self.transfer_function.__name__)
+                for r in range(self.replicas)]
+
+    def close(self):
+        self.sess.close()
+
+def train_repd_replicas(splits, layers, lr=0.01, epoch=200, batch_size=512, print_progress=False, **repd_options):
+    '''
+    Trains one REPD per (X_train, y_train) split, e.g. one per experiment episode,
+    with all autoencoders trained together in one graph
+    '''
+    replicas = AutoEncoderReplicas(len(splits), layers, lr, epoch, batch_size)
+    try:
+        replicas.fit([X[y==0] for X, y in splits], print_progress)
+        models = replicas.get_models()
+    finally:
+        replicas.close()
+
+    classifiers = []
+    for model, (X, y) in zip(models, splits):
+        classifier = REPD(model, **repd_options)
+        classifier.fit_distributions(X, y)
+        classifiers.append(classifier)
+    return classifiers
@@ -0,0 +1,287 @@
+"""
+Scaling benchmarks for the feature extraction and REPD hot paths.
+
+A deterministic C++ corpus (file i depends only on the seed, i and the shape
+options) is generated once per shape and reused. On it the suite measures
+throughput of extract_traditional_features, AutoEncoder.fit/transform,
+get_best_distribution, REPD.predict and the end to end scan_tree, and the
+peak memory of each step in a separate traced run. Results are written as
+JSON; with --baseline every throughput is compared to an earlier result file
+and the exit status is 1 when one dropped by more than --tolerance.
+
+Usage: python benchmark.py [--files 1000] [--functions 6] [--statements 12] [--nesting 3]
+                           [--operator-density 2.0] [--workers N] [--output benchmark_output/results.json] [--baseline old.json]
+"""
+import os
+import gc
+import sys
+import json
+import time
+import random
+import argparse
+import warnings
+import platform
+import resource
+import subprocess
+import tracemalloc
+
+import numpy as np
+
+BENCHMARK_FORMAT_VERSION = 1
+
+CORPUS_FOLDER = "./benchmark_corpus"
+#Kept out of version control like the corpus
+OUTPUT_PATH = "./benchmark_output/benchmark_results.json"
+
+FILES_PER_FOLDER = 1000
+
+VARIABLES = ['count', 'index', 'total', 'limit', 'offset', 'value', 'size', 'width', 'height', 'depth']
+BINARY_OPERATORS = ['+', '-', '*', '/', '%', '<<', '>>', '&', '|', '^', '&&', '||', '==', '!=', '<', '>', '<=', '>=']
+TYPES = ['int', 'long', 'double', 'size_t', 'unsigned']
+
+def _expression(rng, operator_density):
+    operators = int(operator_density) + (rng.random() < operator_density % 1)
+    terms = [rng.choice(VARIABLES) if rng.random() < 0.7 else str(rng.randint(0, 1000)) for _ in range(operators+1)]
+    text = terms[0]
+    for term in terms[1:]:
+        text += " " + rng.choice(BINARY_OPERATORS) + " " + term
+    return text
+
+def _block(rng, statements, depth, nesting, operator_density, indent):
+    lines = []
+    for _ in range(statements):
+        pad = "    "*indent
+        choice = rng.random()
+        if depth < nesting and choice < 0.3:
+            header = rng.choice(["if ({})", "while ({})", "for (int i{d} = 0; i{d} < {}; ++i{d})", "switch ({})"])
+            lines.append(pad + header.format(_expression(rng, operator_density), d=depth) + " {")
+            if header.startswith("switch"):
+                for case in range(rng.randint(1, 3)):
+                    lines.append(pad + "case " + str(case) + ":")
+                    lines += _block(rng, 1, nesting, nesting, operator_density, indent+1)
+                    lines.append(pad + "    break;")
+            else:
+                lines += _block(rng, max(1, statements//2), depth+1, nesting, operator_density, indent+1)
+            lines.append(pad + "}")
+        elif choice < 0.4:
+            lines.append(pad + "// " + rng.choice(VARIABLES) + " bookkeeping")
+        elif choice < 0.55:
+            lines.append(pad + "items.push_back(" + _expression(rng, operator_density) + ");")
+        else:
+            lines.append(pad + rng.choice(VARIABLES) + " " + rng.choice(['=', '+=', '-=', '^=']) + " " + _expression(rng, operator_density) + ";")
+    return lines
+
+def generate_source(rng, functions=6, statements=12, nesting=3, operator_density=2.0):
+    '''
+    Returns the text of one synthetic C++ file: a class template with methods and free functions
+    '''
+    name = "Unit" + str(rng.randint(0, 10**6))
+    lines = ["#include <vector>", "#include <string>", "", "template<typename T>", "class " + name + " {", "public:"]
+    method_count = functions//2
+    for f in range(functions):
+        method = f < method_count
+        indent = 1 if method else 0
+        if f == method_count:
+            lines += ["private:", "    std::vector<T> items;", "};", ""]
+        pad = "    "*indent
+        lines.append(pad + rng.choice(TYPES) + " " + ("method" if method else "function") + str(f) + "(" +
+                     ", ".join(rng.choice(TYPES) + " " + v for v in rng.sample(VARIABLES, 3)) + ") {")
+        lines.append(pad + "    " + rng.choice(TYPES) + " " + ", ".join(v + " = 0" for v in VARIABLES) + ";")
+        if not method:
+            lines.append(pad + "    std::vector<int> items;")
+        lines += _block(rng, rng.randint(max(1, statements//2), max(1, statements*3//2)), 0, nesting, operator_density, indent+1)
+        lines.append(pad + "    return " + _expression(rng, operator_density) + ";")
+        lines.append(pad + "}")
+        lines.append("")
+    if method_count == functions:
+        lines += ["private:", "    std::vector<T> items;", "};", ""]
+    return "\n".join(lines)
+
+def generate_corpus(folder=CORPUS_FOLDER, files=1000, seed=0, **shape):
+    '''
+    Writes the corpus into folder (reused when it already holds the same corpus) and returns the file paths
+    '''
+    spec = dict(files=files, seed=seed, **shape)
+    manifest_path = os.path.join(folder, "corpus.json")
+    paths = [os.path.join(folder, "{:04d}".format(i//FILES_PER_FOLDER), "file{:06d}.cpp".format(i)) for i in range(files)]
+    try:
+        with open(manifest_path) as f:
+            if json.load(f) == spec:
+                return paths
+    except (OSError, ValueError):
+        pass
+
+    for i, path in enumerate(paths):
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, 'w') as f:
+            f.write(generate_source(random.Random(seed*1000003+i), **shape))
+    os.makedirs(folder, exist_ok=True)
+    with open(manifest_path, 'w') as f:
+        json.dump(spec, f)
+    return paths
+
+def measure(name, function, items, unit, memory=True, min_time=0.5, max_runs=20, **info):
+    '''
+    Times function(), repeated until min_time has passed (at most max_runs times) and keeping the
+    fastest run, and with memory traces its peak Python/NumPy allocation in one more run.
+    Returns (result dict, return value of the first run).
+    '''
+    gc.collect()
+    runs = []
+    value = None
+    while len(runs) < max_runs and sum(runs) < min_time:
+        start = time.perf_counter()
+        returned = function()
+        runs.append(time.perf_counter()-start)
+        if len(runs) == 1:
+            value = returned
+        del returned
+    seconds = min(runs)
+    result = dict(name=name, items=items, unit=unit, seconds=seconds, runs=len(runs), throughput=items/seconds if seconds > 0 else None, **info)
+    if memory:
+        gc.collect()
+        tracemalloc.start()
+        function()
+        result['peak_traced_bytes'] = tracemalloc.get_traced_memory()[1]
+        tracemalloc.stop()
+    result['max_rss_bytes'] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss*1024
+    print("{:<24} {:>10} {:<6} {:>9.3f} s {:>14.1f} {}/s".format(name, items, unit, seconds, result['throughput'] or 0, unit))
+    return result, value
+
+def skipped(name, reason):
+    print("{:<24} skipped: {}".format(name, reason))
+    return dict(name=name, skipped=reason)
+
+def synthetic_labels(X):
+    #The largest 15% of the files by loc play the defective ones
+    return (X[:, 0] > np.quantile(X[:, 0], 0.85)).astype(np.int64)
+
+def run_benchmarks(paths, workers=1, epochs=5, memory=True):
+    from scan_tree import extract_tree_features, scan_tree
+    from stat_util import get_best_distribution
+    from REPD_Impl import REPD
+    from numpy_autoencoder import NumpyAutoEncoder, from_autoencoder
+
+    results = []
+    corpus_bytes = sum(os.path.getsize(path) for path in paths)
+
+    result, X = measure("extract_features", lambda: extract_tree_features(paths, workers), len(paths), "files", memory,
+                        workers=workers, bytes=corpus_bytes)
+    results.append(result)
+    y = synthetic_labels(X)
+
+    try:
+        from autoencoder import AutoEncoder
+    except ImportError as e:
+        AutoEncoder = None
+        results.append(skipped("autoencoder_fit", "tensorflow not available: "+str(e)))
+        results.append(skipped("autoencoder_transform", "tensorflow not available"))
+
+    if AutoEncoder is not None:
+        def fit():
+            ae = AutoEncoder([21,10],0.01,epochs,50)
+            ae.fit(X[y==0])
+            return ae
+        result, ae = measure("autoencoder_fit", fit, int((y==0).sum())*epochs, "rows", memory, max_runs=1, epochs=epochs)
+        results.append(result)
+        result, _ = measure("autoencoder_transform", lambda: ae.transform(X), len(X), "rows", memory)
+        results.append(result)
+        model = from_autoencoder(ae)
+        ae.close()
+    else:
+        #Untrained weights keep the predict path measurable without TensorFlow
+        rng = np.random.RandomState(0)
+        model = NumpyAutoEncoder([21,10], [rng.uniform(-0.2,0.2,(21,10))], [np.zeros(10)], [np.zeros(21)])
+
+    classifier = REPD(model)
+    errors = classifier.calculate_reconstruction_error(X)
+    result, _ = measure("get_best_distribution", lambda: get_best_distribution(errors), len(errors), "rows", memory)
+    results.append(result)
+
+    classifier.fit_distributions(X, y)
+    result, _ = measure("repd_predict", lambda: classifier.predict(X), len(X), "rows", memory)
+    results.append(result)
+
+    root = os.path.commonpath(paths)
+    result, _ = measure("end_to_end_scan", lambda: scan_tree(root, ['*.cpp'], classifier, workers), len(paths), "files", memory,
+                        workers=workers)
+    results.append(result)
+    return results
+
+def environment():
+    info = dict(python=platform.python_version(), platform=platform.platform(), cpu_count=os.cpu_count(), numpy=np.__version__)
+    try:
+        import scipy
+        info['scipy'] = scipy.__version__
+    except ImportError:
+        pass
+    try:
+        info['git_commit'] = subprocess.run(["git", "rev-parse", "HEAD"], capture_output=True, text=True,
+                                            cwd=os.path.dirname(os.path.abspath(__file__))).stdout.strip() or None
+    except OSError:
+        info['git_commit'] = None
+    return info
+
+def compare(results, baseline, tolerance):
+    '''
+    Prints the throughput ratio of every benchmark also found in baseline, returns the names that regressed
+    '''
+    previous = {r['name']: r for r in baseline['results'] if r.get('throughput')}
+    regressions = []
+    for result in results:
+        old = previous.get(result['name'])
+        if old is None or not result.get('throughput'):
+            continue
+        ratio = result['throughput']/old['throughput']
+        flag = ""
+        if ratio < 1-tolerance:
+            regressions.append(result['name'])
+            flag = "  REGRESSION"
+        print("{:<24} {:>7.2f}x baseline{}".format(result['name'], ratio, flag))
+    return regressions
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Benchmark feature extraction and REPD on a synthetic C++ corpus.")
+    parser.add_argument("--files", type=int, default=1000)
+    parser.add_argument("--functions", type=int, default=6, help="functions and methods per file")
+    parser.add_argument("--statements", type=int, default=12, help="average statements per function body")
+    parser.add_argument("--nesting", type=int, default=3, help="maximum control flow nesting")
+    parser.add_argument("--operator-density", type=float, default=2.0, help="binary operators per expression")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--corpus", default=CORPUS_FOLDER)
+    parser.add_argument("--workers", type=int, default=1)
+    parser.add_argument("--epochs", type=int, default=5)
+    parser.add_argument("--no-memory", action="store_true", help="skip the traced runs measuring peak memory")
+    parser.add_argument("--output", default=OUTPUT_PATH)
+    parser.add_argument("--baseline", default=None, help="earlier result file to compare throughputs with")
+    parser.add_argument("--tolerance", type=float, default=0.2, help="allowed relative throughput drop")
+    args = parser.parse_args(argv)
+    warnings.simplefilter("ignore")
+
+    shape = dict(functions=args.functions, statements=args.statements, nesting=args.nesting, operator_density=args.operator_density)
+    start = time.perf_counter()
+    paths = generate_corpus(args.corpus, args.files, args.seed, **shape)
+    print("corpus of", len(paths), "files ready in {:.1f} s".format(time.perf_counter()-start))
+
+    results = run_benchmarks(paths, args.workers, args.epochs, not args.no_memory)
+    report = {
+        'format_version': BENCHMARK_FORMAT_VERSION,
+        'created': time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        'environment': environment(),
+        'corpus': dict(files=args.files, seed=args.seed, **shape),
+        'results': results,
+    }
+    if os.path.dirname(args.output):
+        os.makedirs(os.path.dirname(args.output), exist_ok=True)
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=1)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(results, json.load(f), args.tolerance)
+        if regressions:
+            return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,72 @@
+"""
+Single-pass C++ tokenizer used by the feature extractors.
+
+The source is scanned once with one compiled alternation, so comments,
+string/char literals (including raw strings) and multi-character operators
+are recognised in a single left-to-right pass.
+
+This is plain Python on top of the re module, not a native extension. The
+previous extractor made about 55 regex passes over every file (one per
+complexity keyword and per operator, plus the comment and string removal);
+feature extraction with this tokenizer is about 2x faster than that.
+
+Switching to this tokenizer changed the feature values, so EXTRACTOR_VERSION
+is 2:
+    - string and char literals are counted as Halstead operands like
+      numbers already were (the previous extractor removed them first)
+    - every line is classified once as code, comment, code and comment, or
+      blank, so lOCode/lOComment/locCodeAndComment/lOBlank differ on lines
+      mixing code with comments
+Version 2 features can not be compared with version 1 features; feature
+caches, dataset exports and trained models built on version 1 must be
+regenerated.
+"""
+import re
+
+# Token kinds
+WHITESPACE = 'ws'
+COMMENT = 'comment'
+STRING = 'string'
+CHAR = 'char'
+NUMBER = 'number'
+IDENTIFIER = 'identifier'
+OPERATOR = 'operator'
+OTHER = 'other'
+
+# Punctuators ordered longest first so that e.g. '<<=' wins over '<<' and '<'
+PUNCTUATORS = [
+    '<<=', '>>=', '->*', '...',
+    '->', '::', '++', '--', '<<', '>>', '<=', '>=', '==', '!=', '&&', '||',
+    '+=', '-=', '*=', '/=', '%=', '&=', '|=', '^=', '.*', '##',
+    '+', '-', '*', '/', '%', '=', '<', '>', '!', '&', '|', '^', '~',
+    '.', '?', ':', ',', ';', '(', ')', '[', ']', '{', '}', '#'
+]
+
+_TOKEN_PATTERN = re.compile(r'''
+      (?P<ws>\s+)
+    | (?P<comment>//[^\n]*|/\*.*?(?:\*/|\Z))
+    | (?P<string>(?:u8|u|U|L)?R"(?P<delim>[^()\\\s]{0,16})\(.*?\)(?P=delim)"
+                |(?:u8|u|U|L)?"(?:\\.|[^"\\\n])*"?)
+    | (?P<char>(?:u8|u|U|L)?'(?:\\.|[^'\\\n])*'?)
+    | (?P<number>\.?\d(?:[eEpP][+-]|[\w.'])*)
+    | (?P<identifier>[A-Za-z_]\w*)
+    | (?P<operator>''' + '|'.join(re.escape(p) for p in PUNCTUATORS) + r''')
+    | (?P<other>.)
+''', re.VERBOSE | re.DOTALL)
+
+
+def tokenize(source, skip_whitespace=True):
+    """
+    Yields (kind, text, line) tuples for the given C++ source.
+
+    line is the 0-based line on which the token starts. Comments are always
+    yielded so callers can account for comment lines.
+    """
+    line = 0
+    for match in _TOKEN_PATTERN.finditer(source):
+        kind = match.lastgroup
+        text = match.group()
+        if kind != WHITESPACE or not skip_whitespace:
+            yield kind, text, line
+        if kind == WHITESPACE or kind == COMMENT or kind == STRING:
+            line += text.count('\n')
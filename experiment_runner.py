@@ -0,0 +1,240 @@
+"""
+Headless, resumable runner for the experiment grids of the notebooks.
+
+The grid (percentage x dataset x episode x model) is expanded into
+independent tasks that run on a process pool. Every task writes its metrics
+to its own shard file, so a restarted run skips the tasks that already
+finished. All models of an episode see the same split, derived from a seed
+of (experiment, dataset, percentage, episode).
+
+Usage: python experiment_runner.py <traditional|remove|add> [--datasets ...] [--episodes 30] [--workers N] [--threads N] [--merge] [--store]
+"""
+import os
+import sys
+import zlib
+import argparse
+import warnings
+from functools import partial
+from multiprocessing import Pool
+
+import numpy as np
+import pandas as pd
+from sklearn.model_selection import train_test_split
+from sklearn.metrics import balanced_accuracy_score
+
+from promise_data import dataset_settings, load_dataset, ensure_dataset_cache
+from utility import calculate_results
+from thread_budget import pool_initializer, worker_budget
+
+RESULTS_FOLDER = "results"
+
+MODEL_NAMES = ['REPD', 'GaussianNB', 'LogisticRegression', 'KNeighborsClassifier', 'DecisionTreeClassifier', 'HSME']
+
+PERCENTAGES = [0.20,0.19,0.18,0.17,0.16,0.15,0.14,0.13,0.12,0.11,0.10,0.09,0.08,0.07,0.06,0.05]
+
+RESULT_COLUMNS = ['Model', 'Accuracy', 'Precision', 'Recall', 'F1 score','PD','PF']
+
+def calculate_pd(matrix):
+    return matrix[1][1]/(matrix[1][0]+matrix[1][1])
+
+def calculate_pf(matrix):
+    return matrix[0][1]/(matrix[0][0]+matrix[0][1])
+
+def make_model(model_name):
+    if model_name == 'REPD':
+        from REPD_Impl import REPD
+        from autoencoder import AutoEncoder
+        return REPD(AutoEncoder([21,10],0.01,100,50))
+    elif model_name == 'GaussianNB':
+        from sklearn.naive_bayes import GaussianNB
+        return GaussianNB()
+    elif model_name == 'LogisticRegression':
+        from sklearn.linear_model import LogisticRegression
+        return LogisticRegression()
+    elif model_name == 'KNeighborsClassifier':
+        from sklearn.neighbors import KNeighborsClassifier
+        return KNeighborsClassifier(n_neighbors=3)
+    elif model_name == 'DecisionTreeClassifier':
+        from sklearn.tree import DecisionTreeClassifier
+        return DecisionTreeClassifier()
+    elif model_name == 'HSME':
+        from SmoteEnsemble import SmoteEnsemble
+        return SmoteEnsemble()
+    raise ValueError("unknown model "+model_name)
+
+def task_seed(experiment, dataset, percentage, episode):
+    return zlib.crc32("{}/{}/{}/{}".format(experiment, dataset, percentage, episode).encode())
+
+'''
+Returns X_train, X_test, y_train, y_test of an episode, or None when the episode is not
+feasible for the percentage (the notebooks skip those)
+'''
+def episode_split(experiment, X, y, percentage, seed):
+    random_state = np.random.RandomState(seed)
+    if experiment == 'traditional':
+        return train_test_split(X, y, test_size=0.2, random_state=random_state)
+
+    if experiment == 'remove':
+        #Remove defective examples until they make up percentage of the dataset
+        remove_count = int(np.sum(y==1))-int(percentage*len(y))
+        if remove_count < 0:
+            return None
+        indexes = np.flatnonzero(y==1)
+        drop_indices = random_state.choice(indexes, size=remove_count, replace=False)
+        keep = np.ones(len(y), dtype=bool)
+        keep[drop_indices] = False
+        return train_test_split(X[keep], y[keep], test_size=0.2, random_state=random_state)
+
+    if experiment == 'add':
+        #Add non-defective train examples until defective ones make up percentage of the train set
+        X_train, X_test, y_train, y_test = train_test_split(X, y, test_size=0.2, random_state=random_state)
+        add_count = int(round(np.sum(y_train==1)/percentage))-len(y_train)
+        if add_count < 0:
+            return None
+        indexes = np.flatnonzero(y_train==0)
+        add_indices = random_state.choice(indexes, add_count, replace=True)
+        return (np.concatenate([X_train, X_train[add_indices]]), X_test,
+                np.concatenate([y_train, y_train[add_indices]]), y_test)
+
+    raise ValueError("unknown experiment "+experiment)
+
+def shard_path(results_folder, experiment, dataset, percentage, episode, model_name):
+    return os.path.join(results_folder, "shards", experiment, dataset, "{}_{}_{}.csv".format(percentage, episode, model_name))
+
+def expand_grid(experiment, datasets, episode_count, model_names=MODEL_NAMES, percentages=PERCENTAGES):
+    if experiment == 'traditional':
+        percentages = [None]
+    return [(experiment, dataset, percentage, episode, model_name)
+            for percentage in percentages
+            for dataset in datasets
+            for episode in range(1, episode_count+1)
+            for model_name in model_names]
+
+_datasets = {}
+
+def run_task(task, results_folder=RESULTS_FOLDER):
+    '''
+    Runs one model on one episode and writes its metrics shard. Returns the shard path.
+    '''
+    experiment, dataset, percentage, episode, model_name = task
+    path = shard_path(results_folder, *task)
+    if os.path.exists(path):
+        return path
+
+    warnings.simplefilter("ignore")
+    if dataset not in _datasets:
+        _datasets[dataset] = load_dataset(dataset)
+    X, y = _datasets[dataset]
+
+    rows = []
+    split = episode_split(experiment, X, y, percentage, task_seed(experiment, dataset, percentage, episode))
+    if split is not None:
+        X_train, X_test, y_train, y_test = split
+        classifier = make_model(model_name)
+        classifier.fit(X_train, y_train)
+        y_p = classifier.predict(X_test)
+        if model_name == 'REPD':
+            classifier.dim_reduction_model.close()
+
+        matrix, accuracy, precision, recall, f1_score = calculate_results(y_test, y_p)
+        accuracy = balanced_accuracy_score(y_test, y_p)
+        row = [model_name, accuracy, precision, recall, f1_score, calculate_pd(matrix), calculate_pf(matrix)]
+        if percentage is not None:
+            row.append(percentage)
+        rows.append(row)
+
+    #An empty shard marks an infeasible episode as done
+    columns = RESULT_COLUMNS + ([] if percentage is None else ['Percentage'])
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    temp_path = path + ".tmp" + str(os.getpid())
+    pd.DataFrame(rows, columns=columns).to_csv(temp_path, index=False)
+    os.replace(temp_path, path)
+    return path
+
+def run_experiment(experiment, datasets, episode_count=30, workers=None, results_folder=RESULTS_FOLDER, model_names=MODEL_NAMES, threads=None):
+    '''
+    Runs every unfinished task of the grid on a pool of workers processes (None uses all cores).
+    threads - thread budget of every worker for TensorFlow, scikit-learn and BLAS, by default the cores are split between the workers
+    '''
+    tasks = [task for task in expand_grid(experiment, datasets, episode_count, model_names)
+             if not os.path.exists(shard_path(results_folder, *task))]
+    print(len(tasks), "tasks to run")
+
+    if workers is None:
+        workers = os.cpu_count() or 1
+    # REPD tasks are the slowest, start them first so they do not straggle at the end
+    tasks.sort(key=lambda task: task[4] != 'REPD')
+    if threads is None:
+        threads = worker_budget(workers)
+    #Build missing dataset caches once here instead of in every worker
+    for dataset in sorted(set(task[1] for task in tasks)):
+        ensure_dataset_cache(dataset)
+    with Pool(workers, pool_initializer, (threads,)) as pool:
+        for i, _ in enumerate(pool.imap_unordered(partial(run_task, results_folder=results_folder), tasks, chunksize=1)):
+            print("Finished task", i+1, "of", len(tasks))
+
+def read_shards(experiment, dataset, results_folder=RESULTS_FOLDER):
+    '''
+    Returns the finished shards of a dataset as one frame, None when there are none
+    '''
+    folder = os.path.join(results_folder, "shards", experiment, dataset)
+    if not os.path.isdir(folder):
+        return None
+    frames = [pd.read_csv(os.path.join(folder, name)) for name in sorted(os.listdir(folder)) if name.endswith(".csv")]
+    if not frames:
+        return None
+    return pd.concat(frames, ignore_index=True)
+
+def store_shards(experiment, datasets, results_folder=RESULTS_FOLDER, store_folder=None):
+    '''
+    Appends the shards to the columnar ResultsStore (results/store by default) read by result_analysis,
+    one part per experiment and dataset so storing again replaces instead of duplicating them
+    '''
+    from results_store import ResultsStore
+
+    store = ResultsStore(store_folder or os.path.join(results_folder, "store"))
+    for dataset in datasets:
+        results_df = read_shards(experiment, dataset, results_folder)
+        if results_df is None:
+            continue
+        results_df.insert(0, 'Dataset', dataset)
+        results_df.insert(0, 'Experiment', experiment)
+        store.append(results_df, part=experiment+"-"+dataset)
+    return store
+
+def merge_shards(experiment, datasets, results_folder=RESULTS_FOLDER):
+    '''
+    Writes the shards in the results layout the result presentation notebooks read
+    '''
+    for dataset in datasets:
+        results_df = read_shards(experiment, dataset, results_folder)
+        if results_df is None:
+            continue
+        if experiment == 'traditional':
+            results_df.to_csv(os.path.join(results_folder, dataset))
+            continue
+        suffix = '_' if experiment == 'remove' else '_add_'
+        for percentage, percentage_df in results_df.groupby('Percentage'):
+            percentage_df.reset_index(drop=True).to_csv(os.path.join(results_folder, dataset+suffix+str(percentage)), header=False)
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Run an experiment grid of the notebooks as resumable parallel tasks.")
+    parser.add_argument("experiment", choices=['traditional', 'remove', 'add'])
+    parser.add_argument("--datasets", nargs="+", default=list(dataset_settings))
+    parser.add_argument("--models", nargs="+", default=MODEL_NAMES)
+    parser.add_argument("--episodes", type=int, default=30)
+    parser.add_argument("--workers", type=int, default=None, help="CPU budget, number of worker processes")
+    parser.add_argument("--threads", type=int, default=None, help="threads per worker process, the cores are split between workers by default")
+    parser.add_argument("--results", default=RESULTS_FOLDER)
+    parser.add_argument("--merge", action="store_true", help="only merge finished shards into the notebook result files")
+    parser.add_argument("--store", action="store_true", help="also append the finished shards to the columnar results store")
+    args = parser.parse_args(argv)
+
+    if not args.merge:
+        run_experiment(args.experiment, args.datasets, args.episodes, args.workers, args.results, args.models, args.threads)
+    merge_shards(args.experiment, args.datasets, args.results)
+    if args.store:
+        store_shards(args.experiment, args.datasets, args.results)
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -1,5 +1,43 @@
+import os
+import sys
 import numpy as np
-import re
+from cpp_lexer import tokenize, WHITESPACE, COMMENT, STRING, CHAR, NUMBER, IDENTIFIER, OPERATOR
+from instrumentation import stage
+
+# Bumped whenever the produced feature values change, so cached vectors can be invalidated.
+# 2 - cpp_lexer tokenizer: string/char literals are operands and mixed code/comment lines are split (see cpp_lexer)
+EXTRACTOR_VERSION = 2
+
+FEATURE_NAMES = [
+    'loc', 'v(g)', 'ev(g)', 'iv(g)', 'n', 'v', 'l', 'd', 'i', 'e', 'b', 't',
+    'lOCode', 'lOComment', 'lOBlank', 'locCodeAndComment',
+    'uniq_Op', 'uniq_Opnd', 'total_Op', 'total_Opnd', 'branchCount'
+]
+
+# Decision points: if, while, for, switch, case, catch, &&, ||, ?
+COMPLEXITY_KEYWORDS = frozenset(['if', 'while', 'for', 'switch', 'case', 'catch'])
+COMPLEXITY_OPERATORS = frozenset(['&&', '||', '?'])
+
+# C++ operators counted for Halstead metrics
+CPP_OPERATORS = frozenset([
+    '+', '-', '*', '/', '%', '=', '==', '!=', '<', '>', '<=', '>=',
+    '&&', '||', '!', '&', '|', '^', '~', '<<', '>>', '++', '--',
+    '+=', '-=', '*=', '/=', '%=', '&=', '|=', '^=', '<<=', '>>=',
+    '->', '.', '::', '?', ':', ',', ';', '(', ')', '[', ']', '{', '}',
+    'new', 'delete', 'sizeof', 'typeof'
+])
+
+# Keywords are never counted as operands
+CPP_KEYWORDS = frozenset([
+    'auto', 'break', 'case', 'char', 'const', 'continue', 'default', 'do',
+    'double', 'else', 'enum', 'extern', 'float', 'for', 'goto', 'if',
+    'int', 'long', 'register', 'return', 'short', 'signed', 'sizeof',
+    'static', 'struct', 'switch', 'typedef', 'union', 'unsigned', 'void',
+    'volatile', 'while', 'class', 'private', 'public', 'protected',
+    'virtual', 'friend', 'inline', 'operator', 'this', 'new', 'delete',
+    'bool', 'true', 'false', 'namespace', 'using', 'try', 'catch', 'throw'
+])
+
 
 def extract_traditional_features(filepath):
     """
@@ -15,135 +53,100 @@ def extract_traditional_features(filepath):
     Returns:
         numpy.ndarray: A 1x21 NumPy array containing the features.
     """
-    try:
-        with open(filepath, 'r', encoding='utf-8') as f:
-            source_code = f.read()
-    except Exception as e:
-        print(f"Error reading file {filepath}: {e}")
-        # Return a vector of zeros if file can't be read
-        return np.zeros((1, 21))
-
-    # Split into lines for analysis
-    lines = source_code.split('\n')
-    
+    with stage('extract.read', rows=1) as read:
+        try:
+            with open(filepath, 'r', encoding='utf-8') as f:
+                read.add(bytes=os.fstat(f.fileno()).st_size)
+                source_code = f.read()
+        except Exception as e:
+            print(f"Error reading file {filepath}: {e}", file=sys.stderr)
+            # Return a vector of zeros if file can't be read
+            return np.zeros((1, 21))
+
+    with stage('extract.scan', rows=1, bytes=len(source_code)):
+        return extract_features_from_source(source_code)
+
+
+def extract_features_from_source(source_code):
+    """
+    Computes the 21 PROMISE-ordered features from C++ source text in a single token scan.
+
+    Returns:
+        numpy.ndarray: A 1x21 NumPy array containing the features.
+    """
+    return extract_features_from_tokens(tokenize(source_code), source_code.count('\n') + 1)
+
+
+def extract_features_from_tokens(tokens, loc):
+    """
+    Computes the 21 features from already scanned tokens, e.g. the tokens of one function.
+
+    Args:
+        tokens: (kind, text, line) tuples as yielded by cpp_lexer.tokenize, whitespace is ignored.
+        loc (int): Number of source lines the tokens span.
+
+    Returns:
+        numpy.ndarray: A 1x21 NumPy array containing the features.
+    """
+    code_lines = set()
+    comment_lines = set()
+
+    branch_count = 0
+    operator_counts = {}
+    operands = []
+
+    for kind, text, line in tokens:
+        if kind == WHITESPACE:
+            continue
+        if kind == COMMENT:
+            comment_lines.update(range(line, line + text.count('\n') + 1))
+            continue
+
+        if kind == STRING:
+            code_lines.update(range(line, line + text.count('\n') + 1))
+        else:
+            code_lines.add(line)
+
+        if kind == IDENTIFIER:
+            word = text.lower()
+            if word in COMPLEXITY_KEYWORDS:
+                branch_count += 1
+            if text in CPP_OPERATORS:
+                operator_counts[text] = operator_counts.get(text, 0) + 1
+            if word not in CPP_KEYWORDS:
+                operands.append(text)
+        elif kind == OPERATOR:
+            if text in COMPLEXITY_OPERATORS:
+                branch_count += 1
+            if text in CPP_OPERATORS:
+                operator_counts[text] = operator_counts.get(text, 0) + 1
+        elif kind == NUMBER or kind == STRING or kind == CHAR:
+            # Constants and literals are operands
+            operands.append(text)
+
     # --- 1. Raw Metrics (Lines of Code) ---
-    loc = len(lines)  # Total lines of code
-    blank_lines = sum(1 for line in lines if line.strip() == '')
-    
-    # Count comment lines (single line // and multi-line /* */)
-    comment_lines = 0
-    in_multiline_comment = False
-    
-    for line in lines:
-        stripped = line.strip()
-        if in_multiline_comment:
-            comment_lines += 1
-            if '*/' in line:
-                in_multiline_comment = False
-        elif stripped.startswith('//'):
-            comment_lines += 1
-        elif '/*' in line:
-            comment_lines += 1
-            if '*/' not in line:
-                in_multiline_comment = True
-    
-    comments = comment_lines
-    sloc = loc - blank_lines - comment_lines  # Source lines of code (non-empty, non-comment)
-    lloc = sloc  # Logical lines of code (approximation)
-    lOCodeAndComment = 0  # Mixed lines (approximation)
+    # loc is the total lines of code
+    code_and_comment_lines = len(code_lines & comment_lines)
+    sloc = len(code_lines) - code_and_comment_lines  # Code-only lines
+    comments = len(comment_lines) - code_and_comment_lines  # Comment-only lines
+    blank_lines = loc - sloc - comments - code_and_comment_lines
+    lOCodeAndComment = code_and_comment_lines
 
     # --- 2. McCabe's Cyclomatic Complexity (C++ approximation) ---
-    # Count decision points: if, while, for, switch, case, catch, &&, ||, ?
-    complexity_keywords = ['if', 'while', 'for', 'switch', 'case', 'catch']
-    
-    # Remove comments and strings for accurate counting
-    code_without_comments = re.sub(r'//.*', '', source_code)
-    code_without_comments = re.sub(r'/\*.*?\*/', '', code_without_comments, flags=re.DOTALL)
-    code_without_strings = re.sub(r'"[^"]*"', '', code_without_comments)
-    code_without_strings = re.sub(r"'[^']*'", '', code_without_strings)
-    
-    total_complexity = 1  # Base complexity
-    branch_count = 0
-    
-    for keyword in complexity_keywords:
-        # Use word boundaries to avoid partial matches
-        pattern = r'\b' + keyword + r'\b'
-        matches = len(re.findall(pattern, code_without_strings, re.IGNORECASE))
-        total_complexity += matches
-        branch_count += matches
-    
-    # Count logical operators
-    logical_ops = len(re.findall(r'&&|\|\|', code_without_strings))
-    total_complexity += logical_ops
-    branch_count += logical_ops
-    
-    # Count ternary operators
-    ternary_ops = len(re.findall(r'\?', code_without_strings))
-    total_complexity += ternary_ops
-    branch_count += ternary_ops
-
-    v_g = total_complexity
-    ev_g = total_complexity  # Essential complexity (approximation)
-    iv_g = total_complexity  # Design complexity (approximation)
+    v_g = 1 + branch_count
+    ev_g = v_g  # Essential complexity (approximation)
+    iv_g = v_g  # Design complexity (approximation)
 
     # --- 3. Halstead Metrics (C++ approximation) ---
-    # Define C++ operators and keywords
-    cpp_operators = [
-        '+', '-', '*', '/', '%', '=', '==', '!=', '<', '>', '<=', '>=',
-        '&&', '||', '!', '&', '|', '^', '~', '<<', '>>', '++', '--',
-        '+=', '-=', '*=', '/=', '%=', '&=', '|=', '^=', '<<=', '>>=',
-        '->', '.', '::', '?', ':', ',', ';', '(', ')', '[', ']', '{', '}',
-        'new', 'delete', 'sizeof', 'typeof'
-    ]
-    
-    cpp_keywords = [
-        'auto', 'break', 'case', 'char', 'const', 'continue', 'default', 'do',
-        'double', 'else', 'enum', 'extern', 'float', 'for', 'goto', 'if',
-        'int', 'long', 'register', 'return', 'short', 'signed', 'sizeof',
-        'static', 'struct', 'switch', 'typedef', 'union', 'unsigned', 'void',
-        'volatile', 'while', 'class', 'private', 'public', 'protected',
-        'virtual', 'friend', 'inline', 'operator', 'this', 'new', 'delete',
-        'bool', 'true', 'false', 'namespace', 'using', 'try', 'catch', 'throw'
-    ]
-    
-    # Count operators
-    unique_operators = set()
-    total_operators = 0
-    
-    for op in cpp_operators:
-        escaped_op = re.escape(op)
-        if op.isalpha():  # Keywords need word boundaries
-            pattern = r'\b' + escaped_op + r'\b'
-        else:
-            pattern = escaped_op
-        
-        matches = len(re.findall(pattern, code_without_strings))
-        if matches > 0:
-            unique_operators.add(op)
-            total_operators += matches
-    
-    # Count operands (identifiers, constants, string literals)
-    # Simple approximation: words that are not keywords or operators
-    words = re.findall(r'\b[a-zA-Z_][a-zA-Z0-9_]*\b', code_without_strings)
-    numbers = re.findall(r'\b\d+\.?\d*\b', code_without_strings)
-    
-    operands = []
-    for word in words:
-        if word.lower() not in [kw.lower() for kw in cpp_keywords]:
-            operands.append(word)
-    operands.extend(numbers)
-    
-    unique_operands = set(operands)
-    
-    uniq_Op = len(unique_operators)
-    uniq_Opnd = len(unique_operands)
-    total_Op = total_operators
+    uniq_Op = len(operator_counts)
+    uniq_Opnd = len(set(operands))
+    total_Op = sum(operator_counts.values())
     total_Opnd = len(operands)
-    
+
     # Halstead metrics calculations
     n = total_Op + total_Opnd  # Program length
     N = uniq_Op + uniq_Opnd    # Vocabulary
-    
+
     if N > 0 and uniq_Op > 0 and uniq_Opnd > 0:
         v = n * np.log2(N) if N > 1 else 0  # Volume
         d = (uniq_Op / 2.0) * (total_Opnd / uniq_Opnd) if uniq_Opnd > 0 else 0  # Difficulty
@@ -182,4 +185,4 @@ def extract_traditional_features(filepath):
     ]
 
     # Return as a 2D NumPy array (1 row, 21 columns) for prediction
-    return np.array(feature_vector, dtype=np.float32).reshape(1, -1)
\ No newline at end of file
+    return np.array(feature_vector, dtype=np.float32).reshape(1, -1)
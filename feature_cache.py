@@ -0,0 +1,121 @@
+"""
+Persistent feature store keyed by file content hash.
+
+Each store file is a sorted structured .npy array that is opened with
+np.load(mmap_mode='r'), so any number of processes can read it concurrently
+without copying. Writers merge new records into a fresh file under an
+exclusive lock and atomically replace the old one; readers that already
+mapped the previous file keep a valid view of it.
+"""
+import os
+import fcntl
+import hashlib
+import tempfile
+
+import numpy as np
+from extract_traditional_features import EXTRACTOR_VERSION
+
+KEY_DTYPE = 'S32'
+
+FEATURE_RECORD = np.dtype([('key', KEY_DTYPE), ('features', '<f4', (21,))])
+SCORE_RECORD = np.dtype([('key', KEY_DTYPE), ('score', '<f4')])
+
+def content_key(data):
+    '''
+    Returns the cache key (hex blake2b-128 digest) for the raw bytes of a file
+    '''
+    return hashlib.blake2b(data, digest_size=16).hexdigest().encode('ascii')
+
+def file_content_key(path):
+    try:
+        with open(path, 'rb') as f:
+            return content_key(f.read())
+    except OSError:
+        return None
+
+class FeatureCache:
+
+    '''
+    directory - where the store files live, created if missing
+    model_id - identifies the fitted model whose scores are cached; scores are not cached without it
+    '''
+    def __init__(self, directory, model_id=None, extractor_version=EXTRACTOR_VERSION):
+        self.directory = directory
+        os.makedirs(directory, exist_ok=True)
+
+        self.feature_path = os.path.join(directory, "features-v"+str(extractor_version)+".npy")
+        self.score_path = None
+        if model_id is not None:
+            self.score_path = os.path.join(directory, "scores-v"+str(extractor_version)+"-"+str(model_id)+".npy")
+        self.lock_path = os.path.join(directory, ".lock")
+
+    def get_features(self, keys):
+        '''
+        Returns (features, found) where features is a len(keys)*21 matrix and found marks the rows that were cached
+        '''
+        values, found = self.__lookup__(self.feature_path, FEATURE_RECORD, 'features', keys)
+        features = np.zeros((len(keys), 21), dtype=np.float32)
+        features[found] = values
+        return features, found
+
+    def get_scores(self, keys):
+        '''
+        Returns (scores, found) for the configured model_id
+        '''
+        scores = np.full(len(keys), np.nan, dtype=np.float32)
+        if self.score_path is None:
+            return scores, np.zeros(len(keys), dtype=bool)
+        values, found = self.__lookup__(self.score_path, SCORE_RECORD, 'score', keys)
+        scores[found] = values
+        return scores, found
+
+    def put_features(self, keys, features):
+        records = np.zeros(len(keys), dtype=FEATURE_RECORD)
+        records['key'] = keys
+        records['features'] = features
+        self.__merge__(self.feature_path, records)
+
+    def put_scores(self, keys, scores):
+        if self.score_path is None:
+            return
+        records = np.zeros(len(keys), dtype=SCORE_RECORD)
+        records['key'] = keys
+        records['score'] = scores
+        self.__merge__(self.score_path, records)
+
+    def __load__(self, path, record_dtype):
+        try:
+            return np.load(path, mmap_mode='r')
+        except (OSError, ValueError):
+            return np.zeros(0, dtype=record_dtype)
+
+    def __lookup__(self, path, record_dtype, field, keys):
+        keys = np.asarray(keys, dtype=KEY_DTYPE)
+        store = self.__load__(path, record_dtype)
+        if len(store) == 0 or len(keys) == 0:
+            return store[field][:0], np.zeros(len(keys), dtype=bool)
+
+        stored_keys = store['key']
+        index = np.searchsorted(stored_keys, keys)
+        index[index == len(stored_keys)] = 0
+        found = stored_keys[index] == keys
+        return store[field][index[found]], found
+
+    def __merge__(self, path, records):
+        if len(records) == 0:
+            return
+        with open(self.lock_path, 'a') as lock:
+            fcntl.flock(lock, fcntl.LOCK_EX)
+            try:
+                store = self.__load__(path, records.dtype)
+                # New records win over stored ones with the same key
+                merged = np.concatenate([records, np.asarray(store)])
+                _, first = np.unique(merged['key'], return_index=True)
+                merged = merged[first]
+
+                fd, temp_path = tempfile.mkstemp(dir=self.directory, suffix='.tmp')
+                with os.fdopen(fd, 'wb') as f:
+                    np.save(f, merged)
+                os.replace(temp_path, path)
+            finally:
+                fcntl.flock(lock, fcntl.LOCK_UN)
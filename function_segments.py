@@ -0,0 +1,274 @@
+"""
+Function-level segmentation and scoring of C++ files.
+
+A file is tokenized once; the token stream is split into the bodies of free
+functions, methods (also inside class templates such as ResourceCache<T>)
+and out-of-class member definitions, and every body gets its own 21-feature
+vector, comparable to the function level PROMISE rows. Functions are keyed by
+the hash of their text, so with a FeatureCache an edit only re-extracts and
+rescores the functions whose text changed.
+
+Usage: python function_segments.py <file.cpp> ... [--model PATH] [--cache DIR]
+"""
+import sys
+import argparse
+from collections import namedtuple
+
+import numpy as np
+from cpp_lexer import tokenize, WHITESPACE, COMMENT, IDENTIFIER, OPERATOR
+from extract_traditional_features import extract_features_from_tokens
+from feature_cache import FeatureCache, KEY_DTYPE, content_key
+
+# start_line and end_line are 1-based and inclusive, first and last index the token list
+FunctionSpan = namedtuple('FunctionSpan', ['name', 'start_line', 'end_line', 'first', 'last'])
+
+SCOPE_KEYWORDS = frozenset(['class', 'struct', 'union', 'namespace'])
+ACCESS_KEYWORDS = frozenset(['public', 'private', 'protected'])
+
+def split_functions(source):
+    '''
+    Returns (tokens, spans): all tokens of source including whitespace, and the FunctionSpan
+    of every function definition in source order
+    '''
+    tokens = list(tokenize(source, skip_whitespace=False))
+    return tokens, find_function_spans(tokens)
+
+def find_function_spans(tokens):
+    spans = []
+    head = []#Significant token indexes of the declaration being read at namespace/class level
+    scope_depth = 0
+    skip_depth = 0#Braces of initializers and enums, skipped without ending the declaration
+    skipped_declaration = False#The skipped braces end a declaration (enum, array initializer), the head is cleared after them
+    paren_depth = 0
+    function = None#(name, first token) of the function whose body is being read
+    body_depth = 0
+    last_line = -1
+    directive_line = None
+
+    for i, (kind, text, line) in enumerate(tokens):
+        if kind == WHITESPACE or kind == COMMENT:
+            continue
+        #Preprocessor directives, from a leading # to the end of its line
+        if kind == OPERATOR and text == '#' and line != last_line:
+            directive_line = line
+        last_line = line
+        if line == directive_line:
+            continue
+        directive_line = None
+
+        if function is not None:
+            if text == '{':
+                body_depth += 1
+            elif text == '}':
+                body_depth -= 1
+                if body_depth == 0:
+                    name, first = function
+                    spans.append(FunctionSpan(name, tokens[first][2]+1, line+1, first, i))
+                    function = None
+                    head = []
+            continue
+
+        if skip_depth > 0:
+            if text == '{':
+                skip_depth += 1
+            elif text == '}':
+                skip_depth -= 1
+                if skip_depth == 0 and skipped_declaration:
+                    head = []
+            continue
+
+        if text == '(':
+            paren_depth += 1
+        elif text == ')':
+            paren_depth = max(paren_depth-1, 0)
+
+        if text == '{':
+            texts = [tokens[j][1] for j in head]
+            skipped_declaration = False
+            if paren_depth > 0 or len(head) == 0:
+                skip_depth = 1
+            elif '(' not in texts and (SCOPE_KEYWORDS.intersection(texts) or texts[0] == 'extern'):
+                scope_depth += 1
+                head = []
+            elif ')' in texts and ':' in texts[texts.index(')'):] and tokens[head[-1]][0] == IDENTIFIER:
+                #Brace initializer of a constructor initializer list, v{1}; the { stays in the head
+                skip_depth = 1
+                head.append(i)
+            elif _is_function_head(texts):
+                function = (_function_name(tokens, head), head[0])
+                body_depth = 1
+            else:
+                skip_depth = 1
+                skipped_declaration = True
+        elif text == '}':
+            scope_depth = max(scope_depth-1, 0)
+            head = []
+        elif text == ';' and paren_depth == 0:
+            head = []
+        elif text == ':' and len(head) == 1 and tokens[head[0]][1] in ACCESS_KEYWORDS:
+            head = []
+        else:
+            head.append(i)
+    return spans
+
+def _top_level(texts):
+    '''
+    Returns (opens, assignments): positions of the ( and = in texts outside parentheses, brackets and
+    template arguments. The symbol of an operator name (operator=, operator<, operator()) is not counted.
+    '''
+    opens, assignments = [], []
+    depth = 0
+    angle_depth = 0
+    j = 0
+    while j < len(texts):
+        text = texts[j]
+        if text == 'operator':
+            j += 1
+            if texts[j:j+2] == ['(', ')']:
+                j += 2
+            while j < len(texts) and texts[j] != '(':
+                j += 1
+            continue
+        if text in ('(', '['):
+            if depth == 0 and angle_depth == 0 and text == '(':
+                opens.append(j)
+            depth += 1
+        elif text in (')', ']'):
+            depth = max(depth-1, 0)
+        elif depth == 0:
+            if text == '<':
+                angle_depth += 1
+            elif text in ('>', '>>'):
+                angle_depth = max(angle_depth-len(text), 0)
+            elif text == '=' and angle_depth == 0:
+                assignments.append(j)
+        j += 1
+    return opens, assignments
+
+def _is_function_head(texts):
+    '''
+    True if the declaration read before a { is a function definition. The parameter list is the last
+    top-level ( group (a constructor initializer list or a lambda initializer comes after it); an = in
+    front of it makes the { an initializer, e.g. std::function<void()> f = [](){ ... };
+    '''
+    opens, assignments = _top_level(texts)
+    if not opens or ')' not in texts[opens[-1]:]:
+        return False
+    return not any(j < opens[-1] for j in assignments)
+
+def _function_name(tokens, head):
+    '''
+    Qualified name (Outer<T>::name, ~Class, operator==) in front of the parameter list of a definition
+    '''
+    texts = [tokens[j][1] for j in head]
+    if 'operator' in texts:
+        start = texts.index('operator')
+        end = start+1
+        if texts[end:end+2] == ['(', ')']:
+            end += 2
+        while end < len(texts) and texts[end] != '(':
+            end += 1
+    else:
+        #The first top-level ( opens the parameter list, ( inside template arguments such as function<void()> do not
+        end = _top_level(texts)[0][0]
+        start = end-1
+        #Constructor of a template specialisation or template function: name<...>(
+        if texts[start] == '>':
+            start = _matching_open_angle(texts, start)-1
+
+    while start > 0:
+        previous = texts[start-1]
+        if previous == '~':
+            start -= 1
+        elif previous == '::':
+            start -= 1
+            if start > 0 and texts[start-1] in ('>', '>>'):
+                start = _matching_open_angle(texts, start-1)
+            if start > 0 and tokens[head[start-1]][0] == IDENTIFIER:
+                start -= 1
+        else:
+            break
+    return ''.join(texts[max(start, 0):end])
+
+def _matching_open_angle(texts, close):
+    depth = 0
+    for j in range(close, -1, -1):
+        if texts[j] in ('>', '>>'):
+            depth += len(texts[j])
+        elif texts[j] == '<':
+            depth -= 1
+            if depth == 0:
+                return j
+    return close
+
+def function_text(tokens, span):
+    return ''.join(text for _, text, _ in tokens[span.first:span.last+1])
+
+def function_features(tokens, spans):
+    '''
+    Returns a len(spans)*21 feature matrix, one row per function body
+    '''
+    features = np.zeros((len(spans), 21), dtype=np.float32)
+    for i, span in enumerate(spans):
+        features[i] = extract_features_from_tokens(tokens[span.first:span.last+1], span.end_line-span.start_line+1)[0]
+    return features
+
+def extract_function_features(filepath):
+    '''
+    Returns (spans, features) of the functions of a C++ file
+    '''
+    with open(filepath, 'r', encoding='utf-8') as f:
+        tokens, spans = split_functions(f.read())
+    return spans, function_features(tokens, spans)
+
+def score_functions(source, classifier, cache=None):
+    '''
+    Returns a list of (FunctionSpan, defect probability) for the functions of source.
+    With a FeatureCache the features and scores of functions whose text is unchanged are reused,
+    only the edited functions are extracted and scored again.
+    '''
+    tokens, spans = split_functions(source)
+    if len(spans) == 0:
+        return []
+    if cache is None:
+        probabilities = classifier.predict_defect_probability(function_features(tokens, spans))
+        return list(zip(spans, (float(p) for p in probabilities)))
+
+    keys = np.array([content_key(function_text(tokens, span).encode('utf-8')) for span in spans], dtype=KEY_DTYPE)
+    features, found = cache.get_features(keys)
+    missing = np.flatnonzero(~found)
+    if len(missing) > 0:
+        features[missing] = function_features(tokens, [spans[i] for i in missing])
+        cache.put_features(keys[missing], features[missing])
+
+    probabilities, scored = cache.get_scores(keys)
+    unscored = np.flatnonzero(~(scored & found))
+    if len(unscored) > 0:
+        probabilities[unscored] = classifier.predict_defect_probability(features[unscored])
+        cache.put_scores(keys[unscored], probabilities[unscored])
+    return list(zip(spans, (float(p) for p in probabilities)))
+
+def main(argv):
+    from scan_tree import load_or_train_model
+
+    parser = argparse.ArgumentParser(description="Score every function of C++ files with REPD.")
+    parser.add_argument("files", nargs="+")
+    parser.add_argument("--model", default="./repd_model.npz", help="REPD artifact, trained and saved here if missing")
+    parser.add_argument("--train", nargs="+", default=["kc1","kc2"], help="PROMISE datasets to train on")
+    parser.add_argument("--cache", default=None, help="function feature cache directory shared between runs")
+    args = parser.parse_args(argv)
+
+    classifier = load_or_train_model(args.model, args.train)
+    cache = None
+    if args.cache:
+        from repd_artifact import artifact_id
+        cache = FeatureCache(args.cache, artifact_id(args.model))
+
+    for path in args.files:
+        with open(path, 'r', encoding='utf-8') as f:
+            source = f.read()
+        for span, probability in score_functions(source, classifier, cache):
+            print("{:.4f}  {}:{}-{}  {}".format(probability, path, span.start_line, span.end_line, span.name))
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -0,0 +1,206 @@
+"""
+Opt-in stage timing for the REPD pipeline.
+
+The hot paths (feature extraction, AutoEncoder, NumpyAutoEncoder, REPD and
+stat_util) wrap their stages in `with stage(name, rows=..., bytes=...)` or
+decorate them with @timed(name). While instrumentation is disabled, which is
+the default, this costs one function call and a check per stage. Once
+enabled, every stage records its wall time, thread, rows and bytes processed
+and optionally the peak of traced allocations, and the records can be
+exported as a Chrome trace (chrome://tracing, Perfetto) whose otherData holds
+a per-stage summary, or as plain JSON.
+
+Enable it in code with enable(memory=False) and export with
+export_chrome_trace(path), or for a whole run with the environment variable
+REPD_TRACE=path (REPD_TRACE_MEMORY=1 adds allocation peaks); the trace is
+then written when the process exits. Stages running inside pool worker
+processes are not collected.
+"""
+import os
+import json
+import time
+import atexit
+import functools
+import threading
+import tracemalloc
+
+class _NullStage:
+    __slots__ = ()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        return False
+
+    def add(self, rows=0, bytes=0):
+        pass
+
+_NULL_STAGE = _NullStage()
+
+class Recorder:
+
+    '''
+    memory - also record allocation peaks with tracemalloc, which slows Python code down noticeably
+    '''
+    def __init__(self, memory=False):
+        self.memory = memory
+        self.events = []
+        self.local = threading.local()
+        self.origin = time.perf_counter_ns()
+        if memory and not tracemalloc.is_tracing():
+            tracemalloc.start()
+
+    def depth(self):
+        return getattr(self.local, 'depth', 0)
+
+class _Stage:
+
+    __slots__ = ('recorder', 'name', 'rows', 'bytes', 'start', 'start_memory')
+
+    def __init__(self, recorder, name, rows, bytes):
+        self.recorder = recorder
+        self.name = name
+        self.rows = rows
+        self.bytes = bytes
+
+    def add(self, rows=0, bytes=0):
+        '''
+        Counts rows and bytes that only become known while the stage runs
+        '''
+        self.rows = (self.rows or 0)+rows
+        self.bytes = (self.bytes or 0)+bytes
+
+    def __enter__(self):
+        recorder = self.recorder
+        depth = recorder.depth()
+        if recorder.memory:
+            #Peaks are measured from the start of the outermost open stage
+            if depth == 0:
+                tracemalloc.reset_peak()
+            self.start_memory = tracemalloc.get_traced_memory()[0]
+        recorder.local.depth = depth+1
+        self.start = time.perf_counter_ns()
+        return self
+
+    def __exit__(self, *exc):
+        end = time.perf_counter_ns()
+        recorder = self.recorder
+        recorder.local.depth -= 1
+        event = {
+            'name': self.name,
+            'start_ns': self.start-recorder.origin,
+            'duration_ns': end-self.start,
+            'pid': os.getpid(),
+            'tid': threading.get_ident(),
+        }
+        if self.rows is not None:
+            event['rows'] = int(self.rows)
+        if self.bytes is not None:
+            event['bytes'] = int(self.bytes)
+        if recorder.memory:
+            event['alloc_peak_bytes'] = max(tracemalloc.get_traced_memory()[1]-self.start_memory, 0)
+        recorder.events.append(event)
+        return False
+
+_recorder = None
+
+def enable(memory=False):
+    '''
+    Starts recording stages, dropping earlier records
+    '''
+    global _recorder
+    _recorder = Recorder(memory)
+    return _recorder
+
+def disable():
+    global _recorder
+    recorder, _recorder = _recorder, None
+    if recorder is not None and recorder.memory:
+        tracemalloc.stop()
+    return recorder
+
+def enabled():
+    return _recorder is not None
+
+def stage(name, rows=None, bytes=None):
+    '''
+    Context manager timing one stage; rows and bytes may also be added later with .add()
+    '''
+    recorder = _recorder
+    if recorder is None:
+        return _NULL_STAGE
+    return _Stage(recorder, name, rows, bytes)
+
+def timed(name, rows_of=None):
+    '''
+    Decorator running the whole function as a stage; rows_of is the position of the
+    argument (self counts) whose length is recorded as rows
+    '''
+    def decorate(function):
+        @functools.wraps(function)
+        def wrapper(*args, **kwargs):
+            if _recorder is None:
+                return function(*args, **kwargs)
+            rows = None
+            if rows_of is not None and rows_of < len(args) and hasattr(args[rows_of], '__len__'):
+                rows = len(args[rows_of])
+            with _Stage(_recorder, name, rows, None):
+                return function(*args, **kwargs)
+        return wrapper
+    return decorate
+
+def events():
+    return [] if _recorder is None else list(_recorder.events)
+
+def summary():
+    '''
+    Per stage name: calls, total and max seconds, rows, bytes, rows per second and the largest allocation peak
+    '''
+    stages = {}
+    for event in events():
+        entry = stages.setdefault(event['name'], {'calls': 0, 'seconds': 0.0, 'max_seconds': 0.0, 'rows': 0, 'bytes': 0})
+        seconds = event['duration_ns']/1e9
+        entry['calls'] += 1
+        entry['seconds'] += seconds
+        entry['max_seconds'] = max(entry['max_seconds'], seconds)
+        entry['rows'] += event.get('rows', 0)
+        entry['bytes'] += event.get('bytes', 0)
+        if 'alloc_peak_bytes' in event:
+            entry['alloc_peak_bytes'] = max(entry.get('alloc_peak_bytes', 0), event['alloc_peak_bytes'])
+    for entry in stages.values():
+        entry['rows_per_second'] = entry['rows']/entry['seconds'] if entry['rows'] and entry['seconds'] > 0 else None
+    return stages
+
+def export_json(path):
+    with open(path, 'w') as f:
+        json.dump({'summary': summary(), 'events': events()}, f, indent=1)
+
+def export_chrome_trace(path):
+    '''
+    Writes the stages as complete ('X') events of the Chrome trace event format
+    '''
+    trace_events = []
+    for event in events():
+        args = {key: event[key] for key in ('rows', 'bytes', 'alloc_peak_bytes') if key in event}
+        trace_events.append({
+            'name': event['name'],
+            'cat': event['name'].split('.')[0],
+            'ph': 'X',
+            'ts': event['start_ns']/1000.0,
+            'dur': event['duration_ns']/1000.0,
+            'pid': event['pid'],
+            'tid': event['tid'],
+            'args': args,
+        })
+    with open(path, 'w') as f:
+        json.dump({'traceEvents': trace_events, 'displayTimeUnit': 'ms', 'otherData': {'summary': summary()}}, f)
+
+def _export_at_exit(path, pid):
+    #Forked children inherit the recorder but must not overwrite the parent's trace
+    if os.getpid() == pid and _recorder is not None:
+        export_chrome_trace(path)
+
+if os.environ.get('REPD_TRACE'):
+    enable(memory=os.environ.get('REPD_TRACE_MEMORY') == '1')
+    atexit.register(_export_at_exit, os.environ['REPD_TRACE'], os.getpid())
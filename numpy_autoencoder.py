@@ -0,0 +1,139 @@
+"""
+TensorFlow-free forward pass for trained AutoEncoder weights.
+
+Reproduces the tied-weight graph built in autoencoder.AutoEncoder (encoder
+layers W/b, transposed decoder with c) with float32 BLAS matmuls, so scoring
+processes can skip importing TensorFlow, building the graph and probing GPUs.
+"""
+import numpy as np
+from instrumentation import timed
+
+def relu(x):
+    return np.maximum(x, 0, out=x)
+
+def sigmoid(x):
+    np.negative(x, out=x)
+    np.exp(x, out=x)
+    x += 1
+    return np.reciprocal(x, out=x)
+
+def tanh(x):
+    return np.tanh(x, out=x)
+
+def identity(x):
+    return x
+
+TRANSFER_FUNCTIONS = {f.__name__: f for f in (relu, sigmoid, tanh, identity)}
+
+def l2_norm(x):
+    return np.sqrt(np.einsum('ij,ij->i', x, x))
+
+class NumpyAutoEncoder:
+
+    '''
+    layers - layer sizes as given to AutoEncoder
+    W, b, c - encoder weights, encoder biases and decoder biases as returned by AutoEncoder.get_weights
+    block_size - rows evaluated at once, bounds the temporary memory of a call
+    '''
+    def __init__(self, layers, W, b, c, transfer_function='relu', block_size=65536):
+        self.layers = [int(x) for x in layers]
+        self.W = [np.ascontiguousarray(Wi, dtype=np.float32) for Wi in W]
+        self.WT = [np.ascontiguousarray(Wi.T) for Wi in self.W]
+        self.b = [np.asarray(bi, dtype=np.float32) for bi in b]
+        self.c = [np.asarray(ci, dtype=np.float32) for ci in c]
+        if not callable(transfer_function):
+            transfer_function = TRANSFER_FUNCTIONS[transfer_function]
+        self.transfer_function = transfer_function
+        self.error_func = l2_norm
+        self.block_size = block_size
+
+    def fit(self, X):
+        raise NotImplementedError("NumpyAutoEncoder only supports inference, train an AutoEncoder instead")
+
+    def get_weights(self):
+        return self.W, self.b, self.c
+
+    def __encode__(self, X):
+        h = X
+        for Wi, bi in zip(self.W, self.b):
+            h = np.matmul(h, Wi)
+            h += bi
+            h = self.transfer_function(h)
+        return h
+
+    def __decode__(self, h):
+        last = len(self.layers)-2
+        for i in reversed(range(len(self.layers)-1)):
+            h = np.matmul(h, self.WT[i])
+            h += self.c[i]
+            # Mirrors AutoEncoder: the first decoder layer is always activated, the output layer otherwise linear
+            if i == last or i != 0:
+                h = self.transfer_function(h)
+        return h
+
+    def __blocks__(self, X, function, width):
+        X = np.asarray(X, dtype=np.float32)
+        out = np.empty((len(X), width), dtype=np.float32)
+        for start in range(0, len(X), self.block_size):
+            out[start:start+self.block_size] = function(X[start:start+self.block_size])
+        return out
+
+    @timed('numpy_autoencoder.transform', rows_of=1)
+    def transform(self, X):
+        return self.__blocks__(X, self.__encode__, self.layers[-1])
+
+    @timed('numpy_autoencoder.inverse_transform', rows_of=1)
+    def inverse_transform(self, X):
+        return self.__blocks__(X, self.__decode__, self.layers[0])
+
+    @timed('numpy_autoencoder.reconstruction_error', rows_of=1)
+    def reconstruction_error(self, X):
+        X = np.asarray(X, dtype=np.float32)
+        errors = np.empty(len(X), dtype=np.float32)
+        for start in range(0, len(X), self.block_size):
+            block = X[start:start+self.block_size]
+            diff = self.__decode__(self.__encode__(block))
+            diff -= block
+            errors[start:start+self.block_size] = self.error_func(diff)
+        return errors
+
+def from_autoencoder(ae):
+    '''
+    Copies the weights of a trained TensorFlow AutoEncoder
+    '''
+    W, b, c = ae.get_weights()
+    return NumpyAutoEncoder(ae.layers, W, b, c, ae.transfer_function.__name__)
+
+def from_artifact(artifact):
+    '''
+    model_factory for repd_artifact.load_repd
+    '''
+    return NumpyAutoEncoder(artifact['layers'], artifact['W'], artifact['b'], artifact['c'], str(artifact['transfer_function']))
+
+def save_weights(model, path):
+    '''
+    Exports the weights of an AutoEncoder or NumpyAutoEncoder to a plain .npz weights file
+    '''
+    W, b, c = model.get_weights()
+    arrays = {'layers': np.array(model.layers, dtype=np.int64), 'transfer_function': np.array(model.transfer_function.__name__)}
+    for i in range(len(W)):
+        arrays['W'+str(i)] = W[i]
+        arrays['b'+str(i)] = b[i]
+        arrays['c'+str(i)] = c[i]
+    with open(path, 'wb') as f:
+        np.savez(f, **arrays)
+
+def load_weights(path):
+    with np.load(path, allow_pickle=False) as data:
+        layers = data['layers']
+        count = len(layers)-1
+        W = [data['W'+str(i)] for i in range(count)]
+        b = [data['b'+str(i)] for i in range(count)]
+        c = [data['c'+str(i)] for i in range(count)]
+        return NumpyAutoEncoder(layers, W, b, c, str(data['transfer_function']))
+
+def parity_error(reference, candidate, X):
+    '''
+    Largest absolute difference between the reconstruction errors of two models, e.g. an AutoEncoder and its NumPy copy
+    '''
+    return float(np.max(np.abs(np.asarray(reference.reconstruction_error(X)) - candidate.reconstruction_error(X))))
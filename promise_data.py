@@ -0,0 +1,158 @@
+import os
+import json
+import fcntl
+import tempfile
+
+import numpy as np
+import pandas as pd
+from scipy.io import arff
+
+DATA_FOLDER = "./data"
+
+# Cleaned datasets are kept as float32 feature / int8 label .npy files next to a json
+# description, and loaded memory-mapped
+CACHE_FORMAT_VERSION = 1
+
+dataset_settings = {
+  "cm1": ["defects", lambda x: 1 if str(x)=="b'true'" else 0 ],
+  "jm1": ["defects", lambda x: 1 if str(x)=="b'true'" else 0 ],
+  "kc1": ["defects", lambda x: 1 if str(x)=="b'true'" else 0 ],
+  "kc2": ["problems", lambda x: 1 if str(x)=="b'yes'" else 0 ],
+  "pc1": ["defects", lambda x: 1 if str(x)=="b'true'" else 0 ]
+}
+
+def load_dataset_frame(dataset, min_loc=None, data_folder=DATA_FOLDER):
+    '''
+    Loads a PROMISE dataset as a cleaned DataFrame with a binary defect column.
+    Rows with loc below min_loc are dropped when min_loc is given.
+    '''
+    defect_column_name = dataset_settings[dataset][0]
+    defect_column_map_function = dataset_settings[dataset][1]
+
+    # Load dataset
+    data, meta = arff.loadarff(data_folder+"/"+dataset+".arff")
+
+    # Wrap data into a pandas dataframe
+    df = pd.DataFrame(data)
+
+    # Filter out anomalous rows often found in these datasets
+    # These are rows where metrics are unrealistically low (e.g., loc < 2)
+    if min_loc is not None and 'loc' in df.columns:
+        df = df[df['loc'] >= min_loc]
+
+    #Adjust defects column
+    df[defect_column_name] = df[defect_column_name].map(defect_column_map_function)
+
+    #Remove all with missing values
+    df = df.dropna()
+
+    #Remove duplicate instances
+    df = df.drop_duplicates()
+
+    return df
+
+def cache_paths(dataset, min_loc=None, data_folder=DATA_FOLDER):
+    name = dataset if min_loc is None else dataset+"_minloc"+str(min_loc)
+    base = os.path.join(data_folder, "cache", name)
+    return base+"_X.npy", base+"_y.npy", base+".json"
+
+def __source_stamp__(dataset, data_folder):
+    source = os.stat(os.path.join(data_folder, dataset+".arff"))
+    return [source.st_size, source.st_mtime_ns]
+
+def build_dataset_cache(dataset, min_loc=None, data_folder=DATA_FOLDER):
+    '''
+    Converts a PROMISE .arff file once into the cleaned binary cache
+    '''
+    defect_column_name = dataset_settings[dataset][0]
+    df = load_dataset_frame(dataset, min_loc, data_folder)
+    X = np.ascontiguousarray(df.drop(columns=[defect_column_name]).values, dtype=np.float32)
+    y = df[defect_column_name].values.astype(np.int8)
+
+    x_path, y_path, meta_path = cache_paths(dataset, min_loc, data_folder)
+    directory = os.path.dirname(x_path)
+    os.makedirs(directory, exist_ok=True)
+    #Unique temp names, processes building the same cache never write the same file
+    for path, array in ((x_path, X), (y_path, y)):
+        fd, temp_path = tempfile.mkstemp(dir=directory, suffix='.tmp')
+        with os.fdopen(fd, 'wb') as f:
+            np.save(f, array)
+        os.replace(temp_path, path)
+
+    #The description is written last, it marks the cache as complete
+    meta = {
+        'format_version': CACHE_FORMAT_VERSION,
+        'source': dataset+".arff",
+        'source_stamp': __source_stamp__(dataset, data_folder),
+        'columns': [str(c) for c in df.columns if c != defect_column_name],
+        'label_column': defect_column_name,
+        'cleaning': ['map labels to 0/1'] + ([] if min_loc is None else ['loc >= '+str(min_loc)]) + ['dropna', 'drop_duplicates'],
+        'rows': int(len(y)),
+        'defective': int(y.sum()),
+    }
+    fd, temp_path = tempfile.mkstemp(dir=directory, suffix='.tmp')
+    with os.fdopen(fd, 'w') as f:
+        json.dump(meta, f, indent=1)
+    os.replace(temp_path, meta_path)
+    return meta
+
+def ensure_dataset_cache(dataset, min_loc=None, data_folder=DATA_FOLDER):
+    '''
+    Builds the cache unless it is up to date. Concurrent callers (pool workers) wait on a lock
+    and only the first one builds it, the others then read the finished cache.
+    '''
+    meta = read_dataset_cache_meta(dataset, min_loc, data_folder)
+    if meta is not None:
+        return meta
+    meta_path = cache_paths(dataset, min_loc, data_folder)[2]
+    os.makedirs(os.path.dirname(meta_path), exist_ok=True)
+    with open(meta_path+".lock", 'a') as lock:
+        fcntl.flock(lock, fcntl.LOCK_EX)
+        try:
+            meta = read_dataset_cache_meta(dataset, min_loc, data_folder)
+            if meta is None:
+                meta = build_dataset_cache(dataset, min_loc, data_folder)
+        finally:
+            fcntl.flock(lock, fcntl.LOCK_UN)
+    return meta
+
+def read_dataset_cache_meta(dataset, min_loc=None, data_folder=DATA_FOLDER):
+    '''
+    Returns the cache description, or None when the cache is missing or stale
+    '''
+    try:
+        with open(cache_paths(dataset, min_loc, data_folder)[2]) as f:
+            meta = json.load(f)
+    except (OSError, ValueError):
+        return None
+    if meta.get('format_version') != CACHE_FORMAT_VERSION or meta.get('source_stamp') != __source_stamp__(dataset, data_folder):
+        return None
+    return meta
+
+def load_dataset(dataset, min_loc=None, data_folder=DATA_FOLDER, use_cache=True):
+    '''
+    Returns X (float32 N*21 matrix) and y (binary vector) for a PROMISE dataset.
+    With use_cache the arrays are read-only memory maps of the binary cache, built on first use.
+    '''
+    if not use_cache:
+        defect_column_name = dataset_settings[dataset][0]
+        df = load_dataset_frame(dataset, min_loc, data_folder)
+        X = df.drop(columns=[defect_column_name]).values.astype(np.float32)
+        y = df[defect_column_name].values
+        return X, y
+
+    ensure_dataset_cache(dataset, min_loc, data_folder)
+    x_path, y_path, _ = cache_paths(dataset, min_loc, data_folder)
+    return np.load(x_path, mmap_mode='r'), np.load(y_path, mmap_mode='r')
+
+def load_datasets(datasets, min_loc=None, data_folder=DATA_FOLDER):
+    '''
+    Concatenates several PROMISE datasets into one training set
+    '''
+    all_x = []
+    all_y = []
+    for dataset in datasets:
+        X, y = load_dataset(dataset, min_loc, data_folder)
+        all_x.append(X)
+        all_y.append(y)
+    return np.concatenate(all_x, axis=0), np.concatenate(all_y, axis=0)
@@ -0,0 +1,125 @@
+"""
+Versioned single-file artifact for a fitted REPD model.
+
+The artifact is an uncompressed .npz holding the autoencoder layer sizes and
+weights, the fitted dnd/dd distributions, the feature schema and the optional
+decision index, and the training reservoirs and training settings that
+REPD.partial_fit continues from. By default it is loaded into a
+NumpyAutoEncoder, which needs only NumPy and SciPy and can only score;
+TensorFlow is imported only when the weights are restored into an
+AutoEncoder with autoencoder_from_artifact, which can also be trained further.
+"""
+import hashlib
+
+import numpy as np
+import scipy.stats as st
+
+from REPD_Impl import REPD, Reservoir
+from extract_traditional_features import FEATURE_NAMES, EXTRACTOR_VERSION
+from numpy_autoencoder import from_artifact
+
+ARTIFACT_FORMAT_VERSION = 1
+
+def save_repd(classifier, path, feature_names=FEATURE_NAMES):
+    '''
+    Saves a fitted REPD whose dim_reduction_model is an AutoEncoder (or exposes the same weights)
+    '''
+    model = classifier.dim_reduction_model
+    if classifier.error_func is not None or getattr(model.error_func, '__name__', None) != 'l2_norm':
+        raise ValueError("only the default L2 reconstruction error can be persisted")
+
+    W, b, c = model.get_weights()
+    arrays = {
+        'format_version': np.array(ARTIFACT_FORMAT_VERSION),
+        'extractor_version': np.array(EXTRACTOR_VERSION),
+        'feature_names': np.array(feature_names),
+        'layers': np.array(model.layers, dtype=np.int64),
+        'transfer_function': np.array(model.transfer_function.__name__),
+        'error': np.array('l2'),
+        'dnd': np.array(classifier.dnd.name),
+        'dnd_pa': np.array(classifier.dnd_pa, dtype=np.float64),
+        'dd': np.array(classifier.dd.name),
+        'dd_pa': np.array(classifier.dd_pa, dtype=np.float64),
+    }
+    for i in range(len(W)):
+        arrays['W'+str(i)] = W[i]
+        arrays['b'+str(i)] = b[i]
+        arrays['c'+str(i)] = c[i]
+    if classifier.boundaries is not None:
+        arrays['boundaries'] = classifier.boundaries
+        arrays['interval_labels'] = classifier.interval_labels
+    #Training settings and reservoirs, for partial_fit after loading
+    for name in ('lr', 'batch_size'):
+        if hasattr(model, name):
+            arrays[name] = np.array(getattr(model, name))
+    arrays['reservoir_size'] = np.array(classifier.reservoir_size)
+    arrays['drift_threshold'] = np.array(classifier.drift_threshold)
+    for name, reservoir in (('nd_reservoir', classifier.nd_reservoir), ('d_reservoir', classifier.d_reservoir)):
+        if reservoir is not None and reservoir.rows is not None:
+            arrays[name] = reservoir.rows
+            arrays[name+'_seen'] = np.array(reservoir.seen, dtype=np.int64)
+
+    with open(path, 'wb') as f:
+        np.savez(f, **arrays)
+
+def read_artifact(path):
+    '''
+    Returns the artifact contents as a dict, with the weights grouped into lists W, b and c
+    '''
+    with np.load(path, allow_pickle=False) as data:
+        arrays = {name: data[name] for name in data.files}
+
+    format_version = int(arrays['format_version'])
+    if format_version != ARTIFACT_FORMAT_VERSION:
+        raise ValueError("unsupported REPD artifact format "+str(format_version))
+
+    layer_count = len(arrays['layers'])-1
+    arrays['W'] = [arrays.pop('W'+str(i)) for i in range(layer_count)]
+    arrays['b'] = [arrays.pop('b'+str(i)) for i in range(layer_count)]
+    arrays['c'] = [arrays.pop('c'+str(i)) for i in range(layer_count)]
+    return arrays
+
+def autoencoder_from_artifact(artifact):
+    from autoencoder import AutoEncoder
+    import tensorflow.compat.v1 as tf
+
+    transfer_function = getattr(tf.nn, str(artifact['transfer_function']))
+    options = {name: artifact[name].item() for name in ('lr', 'batch_size') if name in artifact}
+    ae = AutoEncoder([int(x) for x in artifact['layers']], transfer_function=transfer_function, **options)
+    return ae.set_weights(artifact['W'], artifact['b'], artifact['c'])
+
+def load_repd(path, model_factory=from_artifact):
+    '''
+    Loads a REPD saved with save_repd.
+    model_factory - builds the dim reduction model from the artifact dict; the default NumpyAutoEncoder only scores,
+    pass autoencoder_from_artifact to continue training with REPD.partial_fit
+    '''
+    artifact = read_artifact(path)
+
+    classifier = REPD(model_factory(artifact))
+    if 'reservoir_size' in artifact:
+        classifier.reservoir_size = int(artifact['reservoir_size'])
+        classifier.drift_threshold = float(artifact['drift_threshold'])
+    if 'nd_reservoir' in artifact and 'd_reservoir' in artifact:
+        classifier.nd_reservoir = Reservoir(classifier.reservoir_size)
+        classifier.d_reservoir = Reservoir(classifier.reservoir_size)
+        for name, reservoir in (('nd_reservoir', classifier.nd_reservoir), ('d_reservoir', classifier.d_reservoir)):
+            reservoir.rows = artifact[name]
+            reservoir.seen = int(artifact[name+'_seen'])
+    classifier.dnd = getattr(st, str(artifact['dnd']))
+    classifier.dnd_pa = tuple(artifact['dnd_pa'].tolist())
+    classifier.dd = getattr(st, str(artifact['dd']))
+    classifier.dd_pa = tuple(artifact['dd_pa'].tolist())
+    if 'boundaries' in artifact:
+        classifier.fast_predict = True
+        classifier.boundaries = artifact['boundaries']
+        classifier.interval_labels = artifact['interval_labels']
+    classifier.feature_names = [str(name) for name in artifact['feature_names']]
+    return classifier
+
+def artifact_id(path):
+    '''
+    Content hash of an artifact file, usable as FeatureCache model_id
+    '''
+    with open(path, 'rb') as f:
+        return hashlib.blake2b(f.read(), digest_size=8).hexdigest()
@@ -0,0 +1,216 @@
+"""
+Successive-halving search over the REPD autoencoder hyperparameters.
+
+A sample of candidates from a space of layers, lr and batch_size is trained
+for a few epochs on the non-defective rows of a training split and scored on
+a stratified validation split. Only the best 1/eta of the candidates are kept
+and trained eta times longer, continuing from their weights, until one
+candidate is left or max_epochs is reached. Weak candidates therefore cost
+min_epochs instead of a full training run. Each rung is trained in parallel
+on a process pool that shares the cores through the thread budget.
+
+Candidates are scored with one of two metrics:
+    f1          F1 score on the validation split of a REPD fitted on the training split
+    separation  Cohen's d between the defective and non-defective validation reconstruction
+                errors; it needs no distribution fit and is much cheaper per rung
+
+The winner is fitted on all rows and returned as a ready REPD, together with
+the score of every candidate at every rung.
+
+Usage: python repd_search.py [--datasets kc1 kc2] [--candidates 27] [--metric f1|separation] [--model PATH]
+"""
+import os
+import sys
+import math
+import argparse
+import itertools
+import warnings
+from multiprocessing import Pool
+
+import numpy as np
+from sklearn.model_selection import train_test_split
+
+from stat_util import cohen_d
+from thread_budget import get_thread_budget, pool_initializer, worker_budget
+
+SEARCH_SPACE = {
+    'layers': [[21,10], [21,15], [21,6], [21,15,10], [21,12,6]],
+    'lr': [0.001, 0.003, 0.01, 0.03],
+    'batch_size': [32, 64, 128, 256],
+}
+
+METRICS = ['f1', 'separation']
+
+def make_autoencoder(layers, lr, epoch, batch_size):
+    from autoencoder import AutoEncoder
+    return AutoEncoder(layers, lr, epoch, batch_size)
+
+def sample_candidates(space, count, seed=0):
+    '''
+    Returns count distinct candidate dicts drawn from the grid of space, the whole grid when it is smaller
+    '''
+    names = sorted(space)
+    grid = list(itertools.product(*[range(len(space[name])) for name in names]))
+    if count is not None and count < len(grid):
+        picks = np.random.RandomState(seed).choice(len(grid), size=count, replace=False)
+        grid = [grid[i] for i in sorted(picks)]
+    return [{name: space[name][i] for name, i in zip(names, indexes)} for indexes in grid]
+
+def rung_schedule(candidate_count, min_epochs, max_epochs, eta):
+    '''
+    Returns (candidates, total epochs) of every rung; the first rung trains all candidates for min_epochs
+    '''
+    rungs = []
+    count, epochs = candidate_count, min_epochs
+    while True:
+        rungs.append((count, min(epochs, max_epochs)))
+        if count == 1 or epochs >= max_epochs:
+            return rungs
+        count, epochs = max(1, count//eta), epochs*eta
+
+_data = None
+
+def _init_worker(threads, data):
+    global _data
+    pool_initializer(threads)
+    _data = data
+
+def evaluate_candidate(task):
+    '''
+    Trains one candidate up to the epochs of a rung and scores it on the validation split.
+    task - (index, candidate, epochs done, epochs of the rung, weights or None, metric, model_factory, distribution_options)
+    Returns (index, score, weights).
+    '''
+    from REPD_Impl import REPD
+    from utility import calculate_results
+
+    index, candidate, done, epochs, weights, metric, model_factory, distribution_options = task
+    X_train, y_train, X_val, y_val = _data
+    warnings.simplefilter("ignore")
+
+    model = model_factory(candidate['layers'], candidate['lr'], epochs, candidate['batch_size'])
+    try:
+        if weights is not None:
+            model.set_weights(*weights)
+        model.fit(X_train[y_train==0], epochs=epochs-done)
+        weights = model.get_weights()
+
+        classifier = REPD(model, distribution_options=distribution_options)
+        if metric == 'separation':
+            errors = classifier.calculate_reconstruction_error(X_val)
+            score = cohen_d(errors[y_val==1], errors[y_val==0])
+        else:
+            classifier.fit_distributions(X_train, y_train)
+            score = calculate_results(y_val, classifier.predict(X_val))[4]
+    finally:
+        if hasattr(model, 'close'):
+            model.close()
+    if not np.isfinite(score):
+        score = -math.inf
+    return index, float(score), weights
+
+def successive_halving(X, y, space=SEARCH_SPACE, candidates=27, min_epochs=10, max_epochs=200, eta=3, metric='f1',
+                       validation_size=0.2, workers=None, threads=None, seed=0, model_factory=make_autoencoder,
+                       distribution_options=None, print_progress=False):
+    '''
+    Searches space for the autoencoder of a REPD on X, y and returns (classifier, history).
+    classifier - REPD with the best candidate, its weights trained on the training split and its distributions fitted on all rows
+    history - one dict per candidate and rung: candidate, rung, epochs, score
+    candidates - number of candidates sampled from the grid of space, None for the whole grid
+    eta - 1/eta of the candidates survive each rung and train eta times as many epochs
+    workers - processes evaluating candidates concurrently, None uses all cores (or the thread budget), 1 runs in this process
+    threads - thread budget of every worker, by default the cores are split between the workers
+    model_factory - callable(layers, lr, epoch, batch_size) returning the dim reduction model, an AutoEncoder by default
+    '''
+    from REPD_Impl import REPD
+
+    if metric not in METRICS:
+        raise ValueError("unknown metric "+metric)
+    X = np.asarray(X, dtype=np.float32)
+    y = np.asarray(y)
+    X_train, X_val, y_train, y_val = train_test_split(X, y, test_size=validation_size, stratify=y,
+                                                      random_state=np.random.RandomState(seed))
+    data = (X_train, y_train, X_val, y_val)
+
+    pool_candidates = sample_candidates(space, candidates, seed)
+    alive = list(range(len(pool_candidates)))
+    weights = [None]*len(pool_candidates)
+    done = [0]*len(pool_candidates)
+    scores = [-math.inf]*len(pool_candidates)
+    history = []
+
+    if workers is None:
+        workers = get_thread_budget() or os.cpu_count() or 1
+    workers = min(workers, len(pool_candidates))
+    pool = None
+    if workers > 1:
+        pool = Pool(workers, _init_worker, (threads or worker_budget(workers), data))
+    else:
+        _init_worker(threads, data)
+    try:
+        for rung, (count, epochs) in enumerate(rung_schedule(len(pool_candidates), min_epochs, max_epochs, eta)):
+            #Keep the count best candidates of the previous rung
+            alive = sorted(alive, key=lambda i: scores[i], reverse=True)[:count]
+            tasks = [(i, pool_candidates[i], done[i], epochs, weights[i], metric, model_factory, distribution_options) for i in alive]
+            results = pool.imap_unordered(evaluate_candidate, tasks) if pool is not None else map(evaluate_candidate, tasks)
+            for i, score, candidate_weights in results:
+                scores[i] = score
+                weights[i] = candidate_weights
+                done[i] = epochs
+                history.append({'candidate': pool_candidates[i], 'rung': rung, 'epochs': epochs, 'score': score})
+                if print_progress:
+                    print("rung", rung, "epochs", epochs, metric, "{:.4f}".format(score), pool_candidates[i])
+    finally:
+        if pool is not None:
+            pool.close()
+            pool.join()
+
+    best = max(alive, key=lambda i: scores[i])
+    candidate = pool_candidates[best]
+    model = model_factory(candidate['layers'], candidate['lr'], done[best], candidate['batch_size'])
+    model.set_weights(*weights[best])
+    classifier = REPD(model, distribution_options=distribution_options)
+    classifier.fit_distributions(X, y)
+    return classifier, history
+
+def search_cost(history, max_epochs):
+    '''
+    Returns (epochs trained by the search, epochs a grid search of the same candidates at max_epochs would train)
+    '''
+    trained = {}
+    for entry in history:
+        key = repr(entry['candidate'])
+        trained[key] = max(trained.get(key, 0), entry['epochs'])
+    return sum(trained.values()), len(trained)*max_epochs
+
+def main(argv):
+    from promise_data import load_datasets
+
+    parser = argparse.ArgumentParser(description="Tune the REPD autoencoder by successive halving.")
+    parser.add_argument("--datasets", nargs="+", default=["kc1","kc2"], help="PROMISE datasets to tune on")
+    parser.add_argument("--candidates", type=int, default=27)
+    parser.add_argument("--min-epochs", type=int, default=10)
+    parser.add_argument("--max-epochs", type=int, default=200)
+    parser.add_argument("--eta", type=int, default=3)
+    parser.add_argument("--metric", choices=METRICS, default='f1')
+    parser.add_argument("--workers", type=int, default=None)
+    parser.add_argument("--threads", type=int, default=None, help="threads per worker process")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--model", default=None, help="save the tuned REPD as an artifact here")
+    args = parser.parse_args(argv)
+
+    X, y = load_datasets(args.datasets, min_loc=2)
+    classifier, history = successive_halving(X, y, candidates=args.candidates, min_epochs=args.min_epochs,
+                                             max_epochs=args.max_epochs, eta=args.eta, metric=args.metric,
+                                             workers=args.workers, threads=args.threads, seed=args.seed, print_progress=True)
+    best = max((entry for entry in history if entry['rung'] == history[-1]['rung']), key=lambda entry: entry['score'])
+    trained, grid = search_cost(history, args.max_epochs)
+    print("Best:", best['candidate'], args.metric, "{:.4f}".format(best['score']), "after", best['epochs'], "epochs")
+    print("Trained", trained, "epochs, a grid search of the same candidates trains", grid)
+
+    if args.model:
+        from repd_artifact import save_repd
+        save_repd(classifier, args.model)
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -0,0 +1,238 @@
+"""
+Vectorised statistics over experiment results, for every model, context and measure at once.
+
+The stat_util helpers filter a results frame by Model for every model and
+model pair, and the notebooks repeat that per dataset and measure. Here the
+rows are grouped once into a NaN-padded array
+
+    values[context, model, measure, sample]
+
+where a context is one combination of the `by` columns (e.g. Dataset and
+Percentage). Every statistic is then computed as array operations over all
+contexts, models and measures:
+
+    pairwise_tests   t-test (ttest_ind, equal variances) and Cohen's d of every model pair
+    normal_tests     D'Agostino-Pearson K^2 normality test (scipy.stats.normaltest)
+    bootstrap_ci     percentile bootstrap confidence interval of the mean
+
+The results match the scalar stat_util helpers and are returned as long
+DataFrames with one row per context, measure and model (pair). The input is
+a results DataFrame, e.g. ResultsStore(folder).to_frame().
+"""
+from collections import namedtuple
+
+import numpy as np
+import pandas as pd
+import scipy.stats as st
+
+from instrumentation import stage
+
+COHEN_D_BOUNDS = [0.2, 0.5, 0.8]
+COHEN_D_INTERPRETATIONS = np.array(["trivial", "small", "moderate", "large"], dtype=object)
+
+# contexts - DataFrame of the by values of every context; values - [context, model, measure, sample], NaN padded,
+# samples sorted with the NaNs last; counts - number of samples of every [context, model, measure]
+SampleGroups = namedtuple('SampleGroups', ['by', 'contexts', 'models', 'measures', 'values', 'counts'])
+
+def group_samples(results_df, measures, by=(), model='Model'):
+    '''
+    Groups the measure samples of results_df by the by columns and model, in one pass
+    '''
+    by = list(by)
+    measures = list(measures)
+    with stage('analysis.group', rows=len(results_df)):
+        model_codes, models = pd.factorize(results_df[model], sort=True)
+        if by:
+            context_codes, contexts = pd.MultiIndex.from_frame(results_df[by]).factorize(sort=True)
+            contexts = contexts.to_frame(index=False, name=by)
+        else:
+            context_codes = np.zeros(len(results_df), dtype=np.int64)
+            contexts = pd.DataFrame(index=[0])
+
+        cells = context_codes.astype(np.int64)*len(models)+model_codes
+        order = np.argsort(cells, kind='stable')
+        sorted_cells = cells[order]
+        cell_sizes = np.bincount(cells, minlength=len(contexts)*len(models))
+        starts = np.concatenate([[0], np.cumsum(cell_sizes)[:-1]])
+        positions = np.arange(len(cells))-starts[sorted_cells]
+
+        width = int(cell_sizes.max()) if len(cells) else 0
+        values = np.full((len(contexts)*len(models), width, len(measures)), np.nan)
+        values[sorted_cells, positions] = results_df[measures].to_numpy(dtype=np.float64)[order]
+        values = values.reshape(len(contexts), len(models), width, len(measures)).transpose(0, 1, 3, 2)
+        #Missing measure values move behind the samples, the order of samples does not matter to any statistic
+        values = np.sort(values, axis=-1)
+        counts = np.sum(~np.isnan(values), axis=-1)
+    return SampleGroups(by, contexts, np.asarray(models), measures, values, counts)
+
+def _moments(groups):
+    '''
+    Returns the mean and unbiased variance of every [context, model, measure] and the deviation of every sample
+    '''
+    n = groups.counts
+    with np.errstate(invalid='ignore', divide='ignore'):
+        mean = np.nansum(groups.values, axis=-1)/n
+        deviation = groups.values-mean[..., None]
+        ss = np.nansum(deviation**2, axis=-1)
+        variance = ss/(n-1)
+    return mean, variance, deviation
+
+def pairwise_tests(groups):
+    '''
+    Returns (t, p, d) arrays [context, model, other model, measure] of the t-test and Cohen's d of every model pair
+    '''
+    n = groups.counts.astype(np.float64)
+    mean, variance, _ = _moments(groups)
+    n1, n2 = n[:, :, None, :], n[:, None, :, :]
+    v1, v2 = variance[:, :, None, :], variance[:, None, :, :]
+    with np.errstate(invalid='ignore', divide='ignore'):
+        dof = n1+n2-2
+        pooled = ((n1-1)*v1+(n2-1)*v2)/dof
+        difference = mean[:, :, None, :]-mean[:, None, :, :]
+        t = difference/np.sqrt(pooled*(1.0/n1+1.0/n2))
+        p = 2*st.t.sf(np.abs(t), dof)
+        d = difference/np.sqrt(pooled)
+    return t, p, d
+
+def normal_test_arrays(groups):
+    '''
+    Returns (k2, p) arrays [context, model, measure] of the D'Agostino-Pearson test, NaN with fewer than 8 samples
+    '''
+    n = groups.counts.astype(np.float64)
+    _, _, deviation = _moments(groups)
+    with np.errstate(invalid='ignore', divide='ignore', over='ignore'):
+        m2 = np.nansum(deviation**2, axis=-1)/n
+        m3 = np.nansum(deviation**3, axis=-1)/n
+        m4 = np.nansum(deviation**4, axis=-1)/n
+
+        #Skewness test
+        b1 = np.where(m2 == 0, 0.0, m3/m2**1.5)
+        y = b1*np.sqrt(((n+1)*(n+3))/(6.0*(n-2)))
+        beta2 = 3.0*(n**2+27*n-70)*(n+1)*(n+3)/((n-2.0)*(n+5)*(n+7)*(n+9))
+        W2 = -1+np.sqrt(2*(beta2-1))
+        delta = 1/np.sqrt(0.5*np.log(W2))
+        alpha = np.sqrt(2.0/(W2-1))
+        y = np.where(y == 0, 1, y)
+        z_skew = delta*np.log(y/alpha+np.sqrt((y/alpha)**2+1))
+
+        #Kurtosis test
+        b2 = np.where(m2 == 0, 3.0, m4/m2**2)
+        E = 3.0*(n-1)/(n+1)
+        varb2 = 24.0*n*(n-2)*(n-3)/((n+1)*(n+1.0)*(n+3)*(n+5))
+        x = (b2-E)/np.sqrt(varb2)
+        sqrtbeta1 = 6.0*(n*n-5*n+2)/((n+7)*(n+9))*np.sqrt((6.0*(n+3)*(n+5))/(n*(n-2)*(n-3)))
+        A = 6.0+8.0/sqrtbeta1*(2.0/sqrtbeta1+np.sqrt(1+4.0/(sqrtbeta1**2)))
+        term1 = 1-2/(9.0*A)
+        denom = 1+x*np.sqrt(2/(A-4.0))
+        term2 = np.sign(denom)*np.where(denom == 0.0, np.nan, ((1-2.0/A)/np.abs(denom))**(1/3.0))
+        z_kurtosis = (term1-term2)/np.sqrt(2/(9.0*A))
+
+        k2 = np.where(n < 8, np.nan, z_skew**2+z_kurtosis**2)
+    return k2, st.chi2.sf(k2, 2)
+
+def bootstrap_arrays(groups, confidence=0.95, resamples=1000, seed=0, block_size=4096):
+    '''
+    Returns (mean, low, high) arrays [context, model, measure] of percentile bootstrap intervals of the mean.
+    A resample is a row of multinomial counts of how often each sample is drawn, so the resampled means of
+    all groups with n samples are one matrix product with the same resamples*n count matrix.
+    block_size - groups multiplied at once, bounds the memory to block_size*resamples values
+    '''
+    values = groups.values.reshape(-1, groups.values.shape[-1])
+    n = groups.counts.reshape(-1)
+    rng = np.random.default_rng(seed)
+    quantiles = [(1-confidence)/2, 1-(1-confidence)/2]
+
+    bounds = np.full((len(values), 2), np.nan)
+    for size in np.unique(n[n > 0]):
+        weights = rng.multinomial(size, np.full(size, 1.0/size), size=resamples).T/size
+        rows = np.flatnonzero(n == size)
+        for start in range(0, len(rows), block_size):
+            block = rows[start:start+block_size]
+            #Samples are stored first, the NaN padding is never multiplied
+            means = values[block, :size] @ weights
+            bounds[block] = np.quantile(means, quantiles, axis=1).T
+    with np.errstate(invalid='ignore', divide='ignore'):
+        mean = np.nansum(values, axis=-1)/n
+    shape = groups.counts.shape
+    return mean.reshape(shape), bounds[:, 0].reshape(shape), bounds[:, 1].reshape(shape)
+
+def _interpret_cohen_d(d):
+    interpretation = COHEN_D_INTERPRETATIONS[np.digitize(np.abs(np.nan_to_num(d)), COHEN_D_BOUNDS)]
+    interpretation[np.isnan(d)] = None
+    return interpretation
+
+def _long_frame(groups, index, columns):
+    '''
+    DataFrame of the by values, measure and model of the [context, model, measure] positions in index
+    '''
+    context, model, measure = index
+    frame = groups.contexts.iloc[context].reset_index(drop=True) if groups.by else pd.DataFrame(index=range(len(context)))
+    frame['Measure'] = np.asarray(groups.measures, dtype=object)[measure]
+    frame['Model'] = groups.models[model]
+    for name, values in columns.items():
+        frame[name] = values
+    return frame
+
+def compare_models(results_df, measures, by=(), model='Model', alpha=0.01, groups=None):
+    '''
+    t-test and Cohen's d of every pair of models with samples in the same context, one row per context, measure and pair:
+    by columns, Measure, Model, Other, n, Other n, statistic-t-test, t-test-p, Different mean values-t-test, Cohen-d, Effect size
+    '''
+    if groups is None:
+        groups = group_samples(results_df, measures, by, model)
+    with stage('analysis.pairwise', rows=groups.values.size):
+        t, p, d = pairwise_tests(groups)
+        n = groups.counts
+        present = (n[:, :, None, :] > 0) & (n[:, None, :, :] > 0)
+        present &= ~np.eye(len(groups.models), dtype=bool)[None, :, :, None]
+        context, first, other, measure = np.nonzero(present)
+        frame = _long_frame(groups, (context, first, measure), {
+            'Other': groups.models[other],
+            'n': n[context, first, measure],
+            'Other n': n[context, other, measure],
+            'statistic-t-test': t[context, first, other, measure],
+            't-test-p': p[context, first, other, measure],
+        })
+        frame['Different mean values-t-test'] = np.where(np.isnan(frame['t-test-p']), None,
+                                                         np.where(frame['t-test-p'] >= alpha, 'no', 'yes'))
+        effect = d[context, first, other, measure]
+        frame['Cohen-d'] = np.abs(effect)
+        frame['Effect size'] = _interpret_cohen_d(effect)
+    return frame
+
+def normal_tests(results_df, measures, by=(), model='Model', alpha=0.001, groups=None):
+    '''
+    Normality test of the samples of every model, context and measure:
+    by columns, Measure, Model, n, Is normal, normal-test-p, k2-normal
+    '''
+    if groups is None:
+        groups = group_samples(results_df, measures, by, model)
+    with stage('analysis.normal_test', rows=groups.values.size):
+        k2, p = normal_test_arrays(groups)
+        context, first, measure = np.nonzero(groups.counts > 0)
+        p = p[context, first, measure]
+        frame = _long_frame(groups, (context, first, measure), {
+            'n': groups.counts[context, first, measure],
+            'Is normal': np.where(np.isnan(p), None, np.where(p < alpha, 'no', 'yes')),
+            'normal-test-p': p,
+            'k2-normal': k2[context, first, measure],
+        })
+    return frame
+
+def bootstrap_ci(results_df, measures, by=(), model='Model', confidence=0.95, resamples=1000, seed=0, groups=None):
+    '''
+    Mean and bootstrap confidence interval of every model, context and measure:
+    by columns, Measure, Model, n, mean, ci-low, ci-high
+    '''
+    if groups is None:
+        groups = group_samples(results_df, measures, by, model)
+    with stage('analysis.bootstrap', rows=groups.values.size):
+        mean, low, high = bootstrap_arrays(groups, confidence, resamples, seed)
+        context, first, measure = np.nonzero(groups.counts > 0)
+        frame = _long_frame(groups, (context, first, measure), {
+            'n': groups.counts[context, first, measure],
+            'mean': mean[context, first, measure],
+            'ci-low': low[context, first, measure],
+            'ci-high': high[context, first, measure],
+        })
+    return frame
@@ -0,0 +1,165 @@
+"""
+Append-friendly columnar store for experiment results.
+
+    <folder>/schema.json              column kinds and the dictionaries of the category columns
+    <folder>/part-<name>/<column>.npy one file per column and part
+
+Every append writes a new part, so appending never rewrites earlier
+results; appending under an existing part name replaces that part, which
+keeps re-running a merge idempotent. Category columns (Model, Dataset,
+Experiment, ...) are stored as int32 codes into dictionaries kept in
+schema.json and numeric columns as float64. Reading memory-maps the parts
+and only concatenates the requested columns; a column missing from an older
+part reads as NaN (numeric) or code -1 (category).
+"""
+import os
+import re
+import json
+import shutil
+
+import numpy as np
+import pandas as pd
+
+STORE_FORMAT_VERSION = 1
+
+CATEGORY = 'category'
+NUMERIC = 'float'
+
+class ResultsStore:
+
+    def __init__(self, folder):
+        self.folder = folder
+        self.schema = {'format_version': STORE_FORMAT_VERSION, 'columns': {}, 'categories': {}}
+        schema_path = os.path.join(folder, "schema.json")
+        if os.path.exists(schema_path):
+            with open(schema_path) as f:
+                self.schema = json.load(f)
+            if self.schema.get('format_version') != STORE_FORMAT_VERSION:
+                raise ValueError("unsupported results store format "+str(self.schema.get('format_version')))
+
+    @property
+    def columns(self):
+        return list(self.schema['columns'])
+
+    def categories(self, column):
+        return self.schema['categories'][column]
+
+    def parts(self):
+        if not os.path.isdir(self.folder):
+            return []
+        return sorted(name for name in os.listdir(self.folder) if name.startswith("part-") and os.path.isdir(os.path.join(self.folder, name)))
+
+    def __len__(self):
+        return sum(self.__part_length__(part) for part in self.parts())
+
+    def __part_length__(self, part):
+        with open(os.path.join(self.folder, part, "length")) as f:
+            return int(f.read())
+
+    '''
+    Appends the rows of a DataFrame (or dict of equal length columns) as a new part.
+    Object, string and categorical columns become category columns, everything else float64.
+    part - name of the part, an existing part of that name is replaced; numbered parts by default
+    '''
+    def append(self, frame, part=None):
+        frame = pd.DataFrame(frame)
+        if part is None:
+            part = "part-{:06d}".format(len(self.parts()))
+            while os.path.exists(os.path.join(self.folder, part)):
+                part += "_"
+        else:
+            part = "part-"+re.sub(r'[^A-Za-z0-9_.-]', '_', str(part))
+
+        arrays = {}
+        for name in frame.columns:
+            name = str(name)
+            column = frame[name]
+            kind = self.schema['columns'].get(name)
+            if kind is None:
+                numeric = pd.api.types.is_numeric_dtype(column) and not pd.api.types.is_bool_dtype(column)
+                kind = NUMERIC if numeric else CATEGORY
+            if kind == CATEGORY:
+                arrays[name] = self.__encode__(name, column)
+            else:
+                arrays[name] = column.to_numpy(dtype=np.float64, na_value=np.nan)
+            self.schema['columns'][name] = kind
+
+        #The part only becomes visible once it is complete, the schema goes first so its codes resolve
+        os.makedirs(self.folder, exist_ok=True)
+        temp_path = os.path.join(self.folder, ".tmp-"+part+"-"+str(os.getpid()))
+        os.makedirs(temp_path)
+        for name, values in arrays.items():
+            np.save(os.path.join(temp_path, name+".npy"), values)
+        with open(os.path.join(temp_path, "length"), 'w') as f:
+            f.write(str(len(frame)))
+        self.__write_schema__()
+        path = os.path.join(self.folder, part)
+        if os.path.exists(path):
+            shutil.rmtree(path)
+        os.replace(temp_path, path)
+        return part
+
+    def __encode__(self, name, column):
+        dictionary = self.schema['categories'].setdefault(name, [])
+        index = {value: code for code, value in enumerate(dictionary)}
+        codes, uniques = pd.factorize(column.astype(object).where(column.notna(), None))
+        mapping = np.empty(len(uniques), dtype=np.int32)
+        for i, value in enumerate(uniques):
+            value = str(value)
+            if value not in index:
+                index[value] = len(dictionary)
+                dictionary.append(value)
+            mapping[i] = index[value]
+        return np.where(codes < 0, -1, mapping[codes] if len(mapping) else -1).astype(np.int32)
+
+    def __write_schema__(self):
+        temp_path = os.path.join(self.folder, "schema.json.tmp"+str(os.getpid()))
+        with open(temp_path, 'w') as f:
+            json.dump(self.schema, f, indent=1)
+        os.replace(temp_path, os.path.join(self.folder, "schema.json"))
+
+    '''
+    Returns {column: array} of all parts; category columns hold their int32 codes
+    '''
+    def read_columns(self, columns=None):
+        columns = self.columns if columns is None else list(columns)
+        chunks = {name: [] for name in columns}
+        for part in self.parts():
+            length = self.__part_length__(part)
+            for name in columns:
+                path = os.path.join(self.folder, part, name+".npy")
+                if os.path.exists(path):
+                    chunks[name].append(np.load(path, mmap_mode='r'))
+                elif self.schema['columns'][name] == CATEGORY:
+                    chunks[name].append(np.full(length, -1, dtype=np.int32))
+                else:
+                    chunks[name].append(np.full(length, np.nan))
+        empty = {CATEGORY: np.zeros(0, dtype=np.int32), NUMERIC: np.zeros(0)}
+        return {name: np.concatenate(chunks[name]) if chunks[name] else empty[self.schema['columns'][name]] for name in columns}
+
+    '''
+    Returns the rows as a DataFrame with pandas Categorical columns for the category columns
+    '''
+    def to_frame(self, columns=None):
+        arrays = self.read_columns(columns)
+        frame = {}
+        for name, values in arrays.items():
+            if self.schema['columns'][name] == CATEGORY:
+                frame[name] = pd.Categorical.from_codes(values, self.categories(name))
+            else:
+                frame[name] = values
+        return pd.DataFrame(frame)
+
+    '''
+    Rewrites all parts as a single part
+    '''
+    def compact(self, part="compacted"):
+        parts = self.parts()
+        if len(parts) < 2:
+            return
+        frame = self.to_frame()
+        target = "part-"+part
+        self.append(frame, part=part+".new")
+        for old in parts:
+            shutil.rmtree(os.path.join(self.folder, old))
+        os.replace(os.path.join(self.folder, "part-"+part+".new"), os.path.join(self.folder, target))
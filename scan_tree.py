@@ -0,0 +1,179 @@
+"""
+Scores every C/C++ source file under a directory with a trained REPD model.
+
+Usage: python scan_tree.py <root> [--glob '*.cpp' ...] [--workers N] [--top K] [--cache DIR] [--model PATH]
+"""
+import os
+import sys
+import argparse
+import fnmatch
+from multiprocessing import Pool
+
+import numpy as np
+from extract_traditional_features import extract_traditional_features
+from feature_cache import FeatureCache, KEY_DTYPE, file_content_key
+from thread_budget import pool_initializer, worker_budget
+
+DEFAULT_GLOBS = ['*.c', '*.cc', '*.cpp', '*.cxx', '*.h', '*.hh', '*.hpp', '*.hxx']
+
+def find_source_files(root, globs=DEFAULT_GLOBS):
+    '''
+    Walks root and returns the paths whose file name or root-relative path matches any glob
+    '''
+    paths = []
+    for directory, subdirectories, file_names in os.walk(root):
+        subdirectories.sort()
+        for file_name in sorted(file_names):
+            path = os.path.join(directory, file_name)
+            relative_path = os.path.relpath(path, root)
+            if any(fnmatch.fnmatch(file_name, g) or fnmatch.fnmatch(relative_path, g) for g in globs):
+                paths.append(path)
+    return paths
+
+def map_files(function, paths, workers=None):
+    '''
+    Applies function to every path on a process pool and returns the results in the order of paths.
+
+    Files are handed out one at a time, largest first, from a shared queue: an idle
+    worker always pulls the next file, so one huge generated file occupies a single
+    worker while the others keep draining the rest of the tree.
+    '''
+    results = [None]*len(paths)
+    if len(paths) == 0:
+        return results
+
+    order = sorted(range(len(paths)), key=lambda i: _file_size(paths[i]), reverse=True)
+    ordered_paths = [paths[i] for i in order]
+
+    if workers is None:
+        workers = os.cpu_count() or 1
+    workers = min(workers, len(paths))
+
+    if workers <= 1:
+        for i, result in zip(order, map(function, ordered_paths)):
+            results[i] = result
+    else:
+        with Pool(workers, pool_initializer, (worker_budget(workers),)) as pool:
+            for i, result in zip(order, pool.imap(function, ordered_paths, chunksize=1)):
+                results[i] = result
+    return results
+
+def extract_tree_features(paths, workers=None):
+    '''
+    Returns an len(paths)*21 feature matrix, rows in the order of paths
+    '''
+    features = np.zeros((len(paths), 21), dtype=np.float32)
+    for i, row in enumerate(map_files(extract_traditional_features, paths, workers)):
+        features[i] = row[0]
+    return features
+
+def scan_tree(root, globs=DEFAULT_GLOBS, classifier=None, workers=None, cache=None):
+    '''
+    Extracts features for every matching file under root in parallel and scores them
+    with a single batched call to the classifier (a fitted REPD).
+    With a FeatureCache only files whose content is not cached are tokenized and scored.
+
+    Returns a list of (path, defect probability) sorted from most to least likely defective.
+    '''
+    if classifier is None:
+        raise ValueError("scan_tree requires a fitted REPD classifier")
+
+    paths = find_source_files(root, globs)
+    if len(paths) == 0:
+        return []
+
+    if cache is None:
+        features = extract_tree_features(paths, workers)
+        probabilities = classifier.predict_defect_probability(features)
+    else:
+        probabilities = _score_with_cache(paths, classifier, workers, cache)
+
+    ranking = np.argsort(-probabilities, kind='stable')
+    return [(paths[i], float(probabilities[i])) for i in ranking]
+
+def _score_with_cache(paths, classifier, workers, cache):
+    keys = map_files(file_content_key, paths, workers)
+    cacheable = np.array([key is not None for key in keys], dtype=bool)
+    keys = np.array([key or b'' for key in keys], dtype=KEY_DTYPE)
+
+    features, found = cache.get_features(keys)
+    found &= cacheable
+    missing = np.flatnonzero(~found)
+    if len(missing) > 0:
+        features[missing] = extract_tree_features([paths[i] for i in missing], workers)
+        new = missing[cacheable[missing]]
+        cache.put_features(keys[new], features[new])
+
+    probabilities, scored = cache.get_scores(keys)
+    # A file with new features always needs a new score
+    scored &= found
+    unscored = np.flatnonzero(~scored)
+    if len(unscored) > 0:
+        probabilities[unscored] = classifier.predict_defect_probability(features[unscored])
+        new = unscored[cacheable[unscored]]
+        cache.put_scores(keys[new], probabilities[new])
+    return probabilities
+
+def print_report(report, top=None, out=sys.stdout):
+    rows = report if top is None else report[:top]
+    for path, probability in rows:
+        out.write("{:.4f}  {}\n".format(probability, path))
+
+def _file_size(path):
+    try:
+        return os.path.getsize(path)
+    except OSError:
+        return 0
+
+def train_default_model(datasets=("kc1","kc2")):
+    '''
+    Trains the REPD model used by testing_locally.py on the given PROMISE datasets
+    '''
+    from REPD_Impl import REPD
+    from autoencoder import AutoEncoder
+    from promise_data import load_datasets
+
+    x, y = load_datasets(datasets, min_loc=2)
+
+    autoencoder = AutoEncoder([21,10],0.01,100,50)
+    classifer = REPD(autoencoder)
+    classifer.fit(x,y)
+    return classifer
+
+def load_or_train_model(model_path, datasets=("kc1","kc2")):
+    '''
+    Loads the REPD artifact at model_path, training and saving it first when it does not exist
+    '''
+    from repd_artifact import save_repd, load_repd
+
+    if model_path is None:
+        return train_default_model(datasets)
+    if not os.path.exists(model_path):
+        save_repd(train_default_model(datasets), model_path)
+    return load_repd(model_path)
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Rank C/C++ files under a directory by REPD defect probability.")
+    parser.add_argument("root")
+    parser.add_argument("--glob", action="append", dest="globs", help="file pattern, may be repeated")
+    parser.add_argument("--workers", type=int, default=None)
+    parser.add_argument("--train", nargs="+", default=["kc1","kc2"], help="PROMISE datasets to train on")
+    parser.add_argument("--top", type=int, default=None)
+    parser.add_argument("--cache", default=None, help="feature cache directory shared between runs")
+    parser.add_argument("--model", default=None, help="REPD artifact, trained and saved here if missing")
+    args = parser.parse_args(argv)
+
+    classifier = load_or_train_model(args.model, args.train)
+    cache = None
+    if args.cache:
+        # Scores are only reusable for the exact same saved model
+        model_id = None
+        if args.model:
+            from repd_artifact import artifact_id
+            model_id = artifact_id(args.model)
+        cache = FeatureCache(args.cache, model_id)
+    report = scan_tree(args.root, args.globs or DEFAULT_GLOBS, classifier, args.workers, cache)
+    print_report(report, args.top)
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
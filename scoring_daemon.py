@@ -0,0 +1,267 @@
+"""
+Resident REPD scoring service.
+
+Loads (or trains once) the REPD model a single time and answers scoring
+requests over a local UNIX socket or stdin/stdout, one JSON object per line:
+
+    {"id": 1, "paths": ["src/a.cpp", "src/b.cpp"]}
+    {"id": 2, "features": [[...21 values...], ...]}
+
+Each request is answered with {"id": ..., "probabilities": [...]} (plus
+"paths" for path requests) or {"id": ..., "error": "..."}. A path that can
+not be read gets a null probability and its message in "errors", a list
+aligned with "paths" that is only present when a path failed. Requests that
+arrive within window_ms of each other are merged into one predict call.
+
+Usage: python scoring_daemon.py [--socket PATH] [--model PATH] [--cache DIR] [--window-ms 2]
+"""
+import os
+import sys
+import json
+import time
+import queue
+import argparse
+import threading
+import socketserver
+from concurrent.futures import Future, ThreadPoolExecutor
+
+import numpy as np
+from extract_traditional_features import extract_features_from_source, FEATURE_NAMES
+from feature_cache import FeatureCache, KEY_DTYPE, content_key
+
+class MicroBatcher:
+
+    '''
+    Scores feature matrices submitted from many threads with one classifier call per batch.
+    window_ms - how long the first request of a batch waits for others to join it
+    max_rows - a batch is scored as soon as it holds this many rows
+    '''
+    def __init__(self, classifier, window_ms=2.0, max_rows=65536):
+        self.classifier = classifier
+        self.window = window_ms/1000.0
+        self.max_rows = max_rows
+        self.requests = queue.Queue()
+        self.thread = threading.Thread(target=self.__run__, daemon=True)
+        self.thread.start()
+
+    def submit(self, features):
+        '''
+        Returns a Future of the defect probabilities of the rows of features.
+        Raises ValueError unless features is a matrix of 21 columns, so a malformed request fails on its own
+        instead of failing the whole batch it would join.
+        '''
+        features = np.asarray(features, dtype=np.float32)
+        if features.ndim != 2 or features.shape[1] != len(FEATURE_NAMES):
+            raise ValueError("features must be a list of rows of {} values, got shape {}".format(len(FEATURE_NAMES), features.shape))
+        future = Future()
+        self.requests.put((features, future))
+        return future
+
+    def score(self, features):
+        return self.submit(features).result()
+
+    def close(self):
+        self.requests.put(None)
+        self.thread.join()
+
+    def __run__(self):
+        while True:
+            request = self.requests.get()
+            if request is None:
+                return
+            batch = [request]
+            rows = len(request[0])
+            deadline = time.perf_counter()+self.window
+            while rows < self.max_rows:
+                timeout = deadline-time.perf_counter()
+                if timeout <= 0:
+                    break
+                try:
+                    request = self.requests.get(timeout=timeout)
+                except queue.Empty:
+                    break
+                if request is None:
+                    self.__score__(batch)
+                    return
+                batch.append(request)
+                rows += len(request[0])
+            self.__score__(batch)
+
+    def __score__(self, batch):
+        try:
+            probabilities = self.classifier.predict_defect_probability(np.concatenate([features for features, _ in batch]))
+        except Exception as e:
+            for _, future in batch:
+                future.set_exception(e)
+            return
+        start = 0
+        for features, future in batch:
+            future.set_result(probabilities[start:start+len(features)])
+            start += len(features)
+
+class ScoringService:
+
+    '''
+    Turns requests into feature matrices, optionally through a FeatureCache, and scores them on a MicroBatcher
+    '''
+    def __init__(self, classifier, cache=None, window_ms=2.0):
+        self.batcher = MicroBatcher(classifier, window_ms)
+        self.cache = cache
+
+    def features_for_paths(self, paths):
+        '''
+        Returns (features, errors): the len(paths)*21 feature matrix and the read error message of every
+        path that could not be read as UTF-8 text, None for the others; rows of failed paths are zero
+        '''
+        features = np.zeros((len(paths), len(FEATURE_NAMES)), dtype=np.float32)
+        errors = [None]*len(paths)
+        sources = [None]*len(paths)
+        for i, path in enumerate(paths):
+            try:
+                with open(path, 'rb') as f:
+                    sources[i] = f.read()
+                sources[i].decode('utf-8')
+            except (OSError, UnicodeDecodeError) as e:
+                errors[i] = "{}: {}".format(e.__class__.__name__, e)
+                sources[i] = None
+        readable = np.array([i for i in range(len(paths)) if errors[i] is None], dtype=np.int64)
+        if len(readable) == 0:
+            return features, errors
+
+        if self.cache is None:
+            for i in readable:
+                features[i] = extract_features_from_source(sources[i].decode('utf-8'))[0]
+            return features, errors
+
+        keys = np.array([content_key(sources[i]) for i in readable], dtype=KEY_DTYPE)
+        cached, found = self.cache.get_features(keys)
+        features[readable] = cached
+        missing = np.flatnonzero(~found)
+        for j in missing:
+            features[readable[j]] = extract_features_from_source(sources[readable[j]].decode('utf-8'))[0]
+        if len(missing) > 0:
+            self.cache.put_features(keys[missing], features[readable[missing]])
+        return features, errors
+
+    def handle(self, request):
+        '''
+        Answers one decoded request dict
+        '''
+        response = {'id': request.get('id')}
+        try:
+            if 'paths' in request:
+                paths = [str(path) for path in request['paths']]
+                features, errors = self.features_for_paths(paths)
+                readable = [i for i in range(len(paths)) if errors[i] is None]
+                probabilities = [None]*len(paths)
+                if readable:
+                    for i, p in zip(readable, self.batcher.score(features[readable])):
+                        probabilities[i] = float(p)
+                response['paths'] = paths
+                response['probabilities'] = probabilities
+                if len(readable) < len(paths):
+                    response['errors'] = errors
+            elif 'features' in request:
+                response['probabilities'] = [float(p) for p in self.batcher.score(request['features'])]
+            else:
+                raise ValueError("request needs 'paths' or 'features'")
+        except Exception as e:
+            response['error'] = "{}: {}".format(e.__class__.__name__, e)
+        return response
+
+    def handle_line(self, line):
+        try:
+            request = json.loads(line)
+        except ValueError as e:
+            return {'id': None, 'error': "invalid JSON: "+str(e)}
+        if not isinstance(request, dict):
+            return {'id': None, 'error': "request must be a JSON object"}
+        return self.handle(request)
+
+    def close(self):
+        self.batcher.close()
+
+def serve_stdio(service, instream=sys.stdin, outstream=sys.stdout, concurrency=8):
+    '''
+    Reads requests line by line, up to concurrency of them are in flight so they can share batches.
+    Responses are written as they complete, match them to requests by id.
+    '''
+    lock = threading.Lock()
+
+    def answer(line):
+        response = json.dumps(service.handle_line(line))
+        with lock:
+            outstream.write(response+"\n")
+            outstream.flush()
+
+    with ThreadPoolExecutor(concurrency) as executor:
+        for line in instream:
+            if line.strip():
+                executor.submit(answer, line)
+
+class _Handler(socketserver.StreamRequestHandler):
+
+    def handle(self):
+        for line in self.rfile:
+            if line.strip():
+                self.wfile.write((json.dumps(self.server.service.handle_line(line))+"\n").encode())
+                self.wfile.flush()
+
+class _Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+def serve_socket(service, socket_path):
+    '''
+    Serves every connection on its own thread until interrupted
+    '''
+    if os.path.exists(socket_path):
+        os.unlink(socket_path)
+    server = _Server(socket_path, _Handler)
+    server.service = service
+    try:
+        server.serve_forever()
+    finally:
+        server.server_close()
+        os.unlink(socket_path)
+
+def request(socket_path, payload):
+    '''
+    Client helper: sends one request dict to a running daemon and returns the response dict
+    '''
+    import socket
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+        s.connect(socket_path)
+        s.sendall((json.dumps(payload)+"\n").encode())
+        with s.makefile('rb') as f:
+            return json.loads(f.readline())
+
+def main(argv):
+    from scan_tree import load_or_train_model
+
+    parser = argparse.ArgumentParser(description="Keep a REPD model loaded and score files or feature vectors on request.")
+    parser.add_argument("--socket", default=None, help="UNIX socket path, stdin/stdout is used without it")
+    parser.add_argument("--model", default="./repd_model.npz", help="REPD artifact, trained and saved here if missing")
+    parser.add_argument("--train", nargs="+", default=["kc1","kc2"], help="PROMISE datasets to train on")
+    parser.add_argument("--cache", default=None, help="feature cache directory shared with scan_tree.py")
+    parser.add_argument("--window-ms", type=float, default=2.0, help="time a request waits for others to share its batch")
+    args = parser.parse_args(argv)
+
+    classifier = load_or_train_model(args.model, args.train)
+    cache = None
+    if args.cache:
+        from repd_artifact import artifact_id
+        cache = FeatureCache(args.cache, artifact_id(args.model))
+    service = ScoringService(classifier, cache, args.window_ms)
+
+    try:
+        if args.socket:
+            serve_socket(service, args.socket)
+        else:
+            serve_stdio(service)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        service.close()
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -0,0 +1,291 @@
+"""
+Builds semantic token vectors from C++ sources, the C++ counterpart of the
+Java AST node sequences in data/*_X.npy.
+
+Every file is scanned with the tokenizer of the traditional features
+(cpp_lexer) and its tokens are classified into node kinds named like the
+Java ones (IF_STATEMENT, METHOD_INVOCATION, INFIX_EXPRESSION, ...). A
+properties file (config/cpp-parser.properties) selects the kinds that are
+kept. Files are scanned on a process pool; the main process maps node kinds
+to integer ids in order of first appearance (a vocabulary that can be
+extended across datasets) and appends the sequences straight to disk as a
+ragged array:
+
+    <name>_values.npy   all ids back to back, memory-mappable
+    <name>_offsets.npy  row boundaries, file i is values[offsets[i]:offsets[i+1]]
+    <name>_y.npy        labels from an optional labels properties file
+    <name>_files.txt    the source file of every row
+    <name>_vocabulary.json
+
+RaggedSequences.load(<name>) opens the result for the extractors.
+
+Usage: python cpp_sequence_extractor.py <root> <name> [--config config/cpp-parser.properties]
+                                         [--labels labels.properties] [--vocabulary vocab.json] [--workers N] [--threads N]
+"""
+import os
+import sys
+import json
+import struct
+import fnmatch
+import argparse
+from multiprocessing import Pool
+
+import numpy as np
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from cpp_lexer import tokenize, COMMENT, STRING, CHAR, NUMBER, IDENTIFIER, OPERATOR
+from thread_budget import get_thread_budget, pool_initializer, worker_budget
+
+DATA_FOLDER = "data"
+CONFIG_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "config", "cpp-parser.properties")
+SOURCE_GLOBS = ['*.c', '*.cc', '*.cpp', '*.cxx', '*.h', '*.hh', '*.hpp', '*.hxx']
+
+KEYWORD_KINDS = {
+    'if': 'IF_STATEMENT', 'else': 'ELSE_CLAUSE', 'for': 'FOR_STATEMENT', 'while': 'WHILE_STATEMENT',
+    'do': 'DO_STATEMENT', 'switch': 'SWITCH_STATEMENT', 'case': 'CASE_LABEL', 'default': 'DEFAULT_LABEL',
+    'break': 'BREAK_STATEMENT', 'continue': 'CONTINUE_STATEMENT', 'return': 'RETURN_STATEMENT',
+    'goto': 'GOTO_STATEMENT', 'try': 'TRY_STATEMENT', 'catch': 'CATCH_CLAUSE', 'throw': 'THROW_STATEMENT',
+    'new': 'NEW_EXPRESSION', 'delete': 'DELETE_EXPRESSION', 'sizeof': 'SIZEOF_EXPRESSION',
+    'static_cast': 'CAST_EXPRESSION', 'dynamic_cast': 'CAST_EXPRESSION', 'const_cast': 'CAST_EXPRESSION',
+    'reinterpret_cast': 'CAST_EXPRESSION', 'this': 'THIS_EXPRESSION', 'true': 'BOOLEAN_LITERAL',
+    'false': 'BOOLEAN_LITERAL', 'nullptr': 'NULL_LITERAL', 'NULL': 'NULL_LITERAL',
+    'template': 'TEMPLATE_DECLARATION', 'class': 'CLASS_DECLARATION', 'struct': 'STRUCT_DECLARATION',
+    'union': 'UNION_DECLARATION', 'enum': 'ENUM_DECLARATION', 'namespace': 'NAMESPACE_DECLARATION',
+    'using': 'USING_DECLARATION', 'typedef': 'TYPEDEF_DECLARATION',
+    'public': 'ACCESS_SPECIFIER', 'private': 'ACCESS_SPECIFIER', 'protected': 'ACCESS_SPECIFIER',
+}
+for _word in ['void', 'bool', 'char', 'short', 'int', 'long', 'float', 'double', 'signed', 'unsigned', 'auto', 'wchar_t', 'size_t']:
+    KEYWORD_KINDS[_word] = 'PRIMITIVE_TYPE'
+for _word in ['const', 'static', 'virtual', 'inline', 'constexpr', 'mutable', 'volatile', 'explicit', 'override', 'final', 'friend', 'extern', 'register']:
+    KEYWORD_KINDS[_word] = 'MODIFIER'
+
+OPERATOR_KINDS = {'?': 'CONDITIONAL_EXPRESSION', '.': 'FIELD_ACCESS', '->': 'FIELD_ACCESS', '::': 'QUALIFIED_NAME',
+                  '[': 'ARRAY_ACCESS', '{': 'BLOCK', '&&': 'LOGICAL_EXPRESSION', '||': 'LOGICAL_EXPRESSION'}
+for _op in ['=', '+=', '-=', '*=', '/=', '%=', '&=', '|=', '^=', '<<=', '>>=']:
+    OPERATOR_KINDS[_op] = 'ASSIGNMENT'
+for _op in ['==', '!=', '<', '>', '<=', '>=']:
+    OPERATOR_KINDS[_op] = 'COMPARISON_EXPRESSION'
+for _op in ['+', '-', '*', '/', '%', '<<', '>>', '&', '|', '^']:
+    OPERATOR_KINDS[_op] = 'INFIX_EXPRESSION'
+for _op in ['!', '~', '++', '--']:
+    OPERATOR_KINDS[_op] = 'PREFIX_EXPRESSION'
+
+# Keywords whose < opens a template argument list rather than a comparison
+TEMPLATE_KEYWORDS = frozenset(['template', 'static_cast', 'dynamic_cast', 'const_cast', 'reinterpret_cast'])
+# Tokens that end the search for the > of a name<...>, a comparison < is never closed before them
+TEMPLATE_STOPS = frozenset([';', '{', '}', '&&', '||'])
+
+LITERAL_KINDS = {STRING: 'STRING_LITERAL', CHAR: 'CHARACTER_LITERAL', NUMBER: 'NUMBER_LITERAL'}
+
+def read_properties(path):
+    properties = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if line and not line.startswith('#') and '=' in line:
+                key, value = line.split('=', 1)
+                properties[key.strip()] = value.strip()
+    return properties
+
+def read_node_config(path=CONFIG_PATH):
+    '''
+    Returns the node kinds enabled in a KIND=true/false properties file, in file order
+    '''
+    return [kind for kind, value in read_properties(path).items() if value.lower() == 'true']
+
+def _closes_template(tokens, i):
+    '''
+    True if the < at tokens[i] is matched by a > before the end of the expression, as in vector<int> or map<K, V>
+    '''
+    angle_depth = 0
+    paren_depth = 0
+    for j in range(i, len(tokens)):
+        text = tokens[j][1]
+        if text in TEMPLATE_STOPS:
+            return False
+        if text == '(':
+            paren_depth += 1
+        elif text == ')':
+            paren_depth -= 1
+            if paren_depth < 0:
+                return False
+        elif text == '<':
+            angle_depth += 1
+        elif text in ('>', '>>'):
+            angle_depth -= len(text)
+            if angle_depth <= 0:
+                return True
+    return False
+
+def node_kinds(source):
+    '''
+    Yields the node kind of every token of C++ source, in source order
+    '''
+    tokens = list(tokenize(source))
+    directive_line = None
+    last_line = -1
+    angle_depth = 0
+    for i, (kind, text, line) in enumerate(tokens):
+        if kind == COMMENT:
+            yield 'LINE_COMMENT' if text.startswith('//') else 'BLOCK_COMMENT'
+            continue
+        #A directive is one node, its tokens are skipped
+        if kind == OPERATOR and text == '#' and line != last_line:
+            directive_line = line
+            last_line = line
+            yield 'PREPROCESSOR_DIRECTIVE'
+            continue
+        last_line = line
+        if line == directive_line:
+            #A backslash at the end of the line continues the directive, e.g. a multi-line #define
+            if text == '\\':
+                directive_line = line+1
+            continue
+
+        if kind == IDENTIFIER:
+            node = KEYWORD_KINDS.get(text)
+            if node is not None:
+                yield node
+            elif i+1 < len(tokens) and tokens[i+1][1] == '(':
+                yield 'METHOD_INVOCATION'
+            else:
+                yield 'SIMPLE_NAME'
+        elif kind == OPERATOR:
+            if text == '<' and (angle_depth > 0 or (i > 0 and (tokens[i-1][1] in TEMPLATE_KEYWORDS or
+                                                                (tokens[i-1][0] == IDENTIFIER and _closes_template(tokens, i))))):
+                angle_depth += 1
+                continue
+            if angle_depth > 0 and text in ('>', '>>'):
+                angle_depth = max(angle_depth-len(text), 0)
+                continue
+            node = OPERATOR_KINDS.get(text)
+            if node is not None:
+                yield node
+        elif kind in LITERAL_KINDS:
+            yield LITERAL_KINDS[kind]
+
+class _Scanner:
+
+    '''
+    Picklable per-file worker: returns the indexes (into kinds) of the enabled node kinds of a file
+    '''
+    def __init__(self, kinds):
+        self.kinds = kinds
+
+    def __call__(self, path):
+        index = {kind: i for i, kind in enumerate(self.kinds)}
+        try:
+            with open(path, 'r', encoding='utf-8', errors='replace') as f:
+                source = f.read()
+        except OSError as e:
+            print("Error reading file {}: {}".format(path, e), file=sys.stderr)
+            return np.zeros(0, dtype=np.uint16)
+        return np.array([index[node] for node in node_kinds(source) if node in index], dtype=np.uint16)
+
+def find_sources(root, globs=SOURCE_GLOBS):
+    paths = []
+    for directory, subdirectories, file_names in os.walk(root):
+        subdirectories.sort()
+        for file_name in sorted(file_names):
+            if any(fnmatch.fnmatch(file_name, g) for g in globs):
+                paths.append(os.path.join(directory, file_name))
+    return paths
+
+class NpyAppender:
+
+    '''
+    Writes a 1-D .npy file whose length is only known at the end: rows are appended
+    after a fixed size header that close() rewrites with the final shape
+    '''
+    HEADER_SIZE = 128
+
+    def __init__(self, path, dtype):
+        self.path = path
+        self.dtype = np.dtype(dtype)
+        self.length = 0
+        self.file = open(path, 'wb')
+        self.file.write(self.__header__(0))
+
+    def __header__(self, length):
+        header = "{'descr': %r, 'fortran_order': False, 'shape': (%d,), }" % (self.dtype.str, length)
+        header = header.ljust(self.HEADER_SIZE-10-1)+"\n"
+        return b'\x93NUMPY\x01\x00'+struct.pack('<H', len(header))+header.encode('latin1')
+
+    def append(self, values):
+        values = np.ascontiguousarray(values, dtype=self.dtype)
+        self.file.write(values.tobytes())
+        self.length += len(values)
+
+    def close(self):
+        self.file.seek(0)
+        self.file.write(self.__header__(self.length))
+        self.file.close()
+
+def extract_sequences(paths, prefix, kinds, vocabulary=None, labels=None, root=None, workers=None, threads=None):
+    '''
+    Scans paths in parallel and writes the ragged dataset files of prefix.
+    vocabulary - kind to id map of an earlier dataset, extended with new kinds (ids start at 1, 0 is padding)
+    labels - label of each file keyed by its path relative to root, missing files get 0
+    workers - scanning processes, None uses all cores (or the thread budget)
+    threads - thread budget of every worker, by default the cores are split between the workers
+    Returns the vocabulary.
+    '''
+    vocabulary = dict(vocabulary or {})
+    #Vocabulary id of every kind index, 0 until the kind first appears
+    ids = np.array([vocabulary.get(kind, 0) for kind in kinds], dtype=np.int64)
+
+    offsets = np.zeros(len(paths)+1, dtype=np.int64)
+    y = np.zeros(len(paths), dtype=np.int64)
+    values = NpyAppender(prefix+"_values.npy", np.uint16)
+    scanner = _Scanner(kinds)
+    if workers is None:
+        workers = get_thread_budget() or os.cpu_count() or 1
+    if threads is None:
+        threads = worker_budget(workers)
+    try:
+        with Pool(workers, pool_initializer, (threads,)) as pool:
+            for i, sequence in enumerate(pool.imap(scanner, paths, chunksize=8)):
+                new_kinds, first = np.unique(sequence[ids[sequence] == 0], return_index=True)
+                for kind_index in new_kinds[np.argsort(first)]:
+                    vocabulary[kinds[kind_index]] = ids[kind_index] = len(vocabulary)+1
+                values.append(ids[sequence])
+                offsets[i+1] = values.length
+                if labels is not None:
+                    y[i] = int(labels.get(os.path.relpath(paths[i], root) if root else paths[i], 0))
+    finally:
+        values.close()
+
+    np.save(prefix+"_offsets.npy", offsets)
+    np.save(prefix+"_y.npy", y)
+    with open(prefix+"_files.txt", 'w') as f:
+        f.write("\n".join(paths)+"\n")
+    with open(prefix+"_vocabulary.json", 'w') as f:
+        json.dump(vocabulary, f, indent=1)
+    return vocabulary
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Extract node kind sequences from C++ sources for the semantic extractors.")
+    parser.add_argument("root")
+    parser.add_argument("name", help="dataset name, the files are written to <data>/<name>_*")
+    parser.add_argument("--config", default=CONFIG_PATH, help="node kind properties file")
+    parser.add_argument("--labels", default=None, help="properties file of <path relative to root>=<label>")
+    parser.add_argument("--vocabulary", default=None, help="vocabulary json of an earlier dataset to keep ids consistent")
+    parser.add_argument("--workers", type=int, default=None)
+    parser.add_argument("--threads", type=int, default=None, help="threads per worker process, the cores are split between workers by default")
+    parser.add_argument("--data", default=DATA_FOLDER)
+    args = parser.parse_args(argv)
+
+    vocabulary = None
+    if args.vocabulary:
+        with open(args.vocabulary) as f:
+            vocabulary = json.load(f)
+    labels = read_properties(args.labels) if args.labels else None
+
+    paths = find_sources(args.root)
+    os.makedirs(args.data, exist_ok=True)
+    vocabulary = extract_sequences(paths, os.path.join(args.data, args.name), read_node_config(args.config),
+                                   vocabulary, labels, args.root, args.workers, args.threads)
+    print(len(paths), "files,", len(vocabulary), "node kinds")
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
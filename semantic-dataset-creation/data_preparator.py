@@ -1,3 +1,4 @@
+import os
 import sys
 import warnings
 
@@ -5,6 +6,7 @@ if not sys.warnoptions:
     warnings.simplefilter("ignore")
 
 from extractor import DeepAutoencoder, DeepBeliefNetwork, ConvolutionalAutoencoder
+from ragged import RaggedSequences
 import numpy as np
 
 DATA_FOLDER = "data"
@@ -17,6 +19,13 @@ def prepare_data(data):
     return ret 
 
 
+def prepare_ragged_data(data):
+    """
+    Token vectors without padding, the extractors pad them one batch at a time
+    """
+    return RaggedSequences.from_lists(data, align=8)
+
+
 def main():
 
     FILE_NAMES = ["ant-1.5.csv", "ant-1.6.csv", "camel-1.2.csv", "camel-1.4.csv", "log4j-1.1.csv", "log4j-1.2.csv", "poi-2.0.csv", "poi-2.5.csv"]
@@ -27,11 +36,13 @@ def main():
 
         for num in range(COUNT):
             
-            #Can be loaded from a different source
-            X = np.load(DATA_FOLDER + "/" + name + "_X.npy")
+            #Can be loaded from a different source, cpp_sequence_extractor writes ragged C++ datasets
+            if os.path.exists(DATA_FOLDER + "/" + name + "_values.npy"):
+                X = RaggedSequences.load(DATA_FOLDER + "/" + name)
+            else:
+                X = prepare_ragged_data(np.load(DATA_FOLDER + "/" + name + "_X.npy"))
             y = np.load(DATA_FOLDER + "/" + name + "_y.npy")
             
-            X = prepare_data(X)
             y = np.array([np.array(x) for x in y])
             
 
@@ -7,7 +7,9 @@ from keras.layers import Input, Dense, Convolution1D, MaxPooling1D, UpSampling1D
 from keras.models import Model
 from keras import backend as K
 from keras.models import load_model
+from keras.utils import Sequence
 from dbn import *
+from ragged import RaggedSequences
 
 class Extractor(ABC):
     """
@@ -21,11 +23,84 @@ class Extractor(ABC):
         pass
 
 
+class RaggedBatches(Sequence):
+    """
+    Autoencoder training batches (x, x) padded from RaggedSequences.
+    Rows are grouped into length buckets and every batch is padded to the width of its
+    bucket only, or to width when the model needs a fixed input width.
+    """
+    def __init__(self, sequences, batch_size=20, bucket_count=4, width=None, channel=False, shuffle=True, seed=None):
+        self.sequences = sequences
+        self.batch_size = batch_size
+        self.width = width
+        self.channel = channel
+        self.shuffle = shuffle
+        self.rng = np.random.RandomState(seed)
+        self.buckets = sequences.buckets(bucket_count) if width is None else [(width, np.arange(len(sequences)))]
+        self.on_epoch_end()
+
+    def on_epoch_end(self):
+        self.batches = []
+        for width, rows in self.buckets:
+            if self.shuffle:
+                rows = self.rng.permutation(rows)
+            self.batches += [(width, rows[i:i+self.batch_size]) for i in range(0, len(rows), self.batch_size)]
+        if self.shuffle:
+            self.batches = [self.batches[i] for i in self.rng.permutation(len(self.batches))]
+
+    def __len__(self):
+        return len(self.batches)
+
+    def __getitem__(self, index):
+        width, rows = self.batches[index]
+        x = self.sequences.dense(rows, width)
+        if self.channel:
+            x = x.reshape((x.shape[0], x.shape[1], 1))
+        return x, x
+
+
+class TorchBatches:
+    """
+    RaggedBatches as the iterable of (batch, label) tensors an RBM trains on, reshuffled every epoch
+    """
+    def __init__(self, batches):
+        self.batches = batches
+
+    def __len__(self):
+        return len(self.batches)
+
+    def __iter__(self):
+        for index in range(len(self.batches)):
+            x, _ = self.batches[index]
+            yield torch.from_numpy(x), torch.zeros(len(x))
+        self.batches.on_epoch_end()
+
+
+def predict_ragged(model, sequences, width, batch_size=256, channel=False):
+    """
+    Runs model on the rows of sequences padded to width, one batch at a time
+    """
+    outputs = []
+    for i in range(0, len(sequences), batch_size):
+        x = sequences.dense(np.arange(i, min(i+batch_size, len(sequences))), width)
+        if channel:
+            x = x.reshape((x.shape[0], x.shape[1], 1))
+        outputs.append(model.predict_on_batch(x))
+    return np.concatenate(outputs)
+
+
 class ConvolutionalAutoencoder(Extractor):
     """ 
     A convolutional autoencoder for feature extraction
     """
+    def __init__(self, batch_size=20, bucket_count=4):
+        super().__init__()
+        self.batch_size = batch_size
+        self.bucket_count = bucket_count
+
     def get_features(self, input_vecs, label_vecs):
+        if isinstance(input_vecs, RaggedSequences):
+            return self.__get_ragged_features(input_vecs)
         self.input_vecs = input_vecs
         self.model, self.encoder = self.__init_model(vecs_shape=self.input_vecs.shape)
         self.input_vecs = self.input_vecs.reshape((self.input_vecs.shape[0], self.input_vecs.shape[1], 1))
@@ -61,6 +136,52 @@ class ConvolutionalAutoencoder(Extractor):
         return autoencoder, encoder_model
 
 
+    def __get_ragged_features(self, sequences):
+        # The reconstruction path is fully convolutional, so it trains on batches padded only to
+        # the width of their length bucket. The flattened encoder output needs the full width.
+        width = sequences.width
+        self.model, self.encoder = self.__init_ragged_model(width)
+        self.model.compile(optimizer='adadelta', loss='binary_crossentropy')
+        batches = RaggedBatches(sequences, self.batch_size, self.bucket_count, channel=True)
+        self.model.fit(batches, epochs=1000)
+        return predict_ragged(self.encoder, sequences, width, channel=True)
+
+
+    def __init_ragged_model(self, width):
+        encoder_layers = [
+            Convolution1D(16, 3, activation='relu', padding='same'),
+            MaxPooling1D(2, padding='same'),
+            Convolution1D(8, 3, activation='relu', padding='same'),
+            MaxPooling1D(2, padding='same'),
+            Convolution1D(8, 3, activation='relu', padding='same'),
+        ]
+
+        def encode(x):
+            for layer in encoder_layers:
+                x = layer(x)
+            return x
+
+        input_vec = Input(shape=(None, 1))
+        encoder = MaxPooling1D(2, padding='same')(encode(input_vec))
+
+        x = Convolution1D(8, 3, activation='relu', padding='same')(encoder)
+        x = UpSampling1D(2)(x)
+        x = Convolution1D(8, 3, activation='relu', padding='same')(x)
+        x = UpSampling1D(2)(x)
+        x = Convolution1D(16, 3, activation='relu', padding='same')(x)
+        x = UpSampling1D(2)(x)
+        decoder = Convolution1D(1, 3, activation='sigmoid', padding='same')(x)
+
+        fixed_input_vec = Input(shape=(width, 1))
+        y = Flatten()(encode(fixed_input_vec))
+        y = Dense(100, activation='softmax')(y)
+
+        encoder_model = Model(fixed_input_vec, y)
+        autoencoder = Model(input_vec, decoder)
+
+        return autoencoder, encoder_model
+
+
     def __train(self, train):
         self.model.compile(optimizer='adadelta', loss='binary_crossentropy')
         self.model.fit(train, train, epochs=1000, batch_size=20, shuffle=True)
@@ -71,7 +192,13 @@ class DeepAutoencoder(Extractor):
     """ 
     A deep autoencoder for feature extraction
     """
+    def __init__(self, batch_size=20):
+        super().__init__()
+        self.batch_size = batch_size
+
     def get_features(self, input_vecs, label_vecs):
+        if isinstance(input_vecs, RaggedSequences):
+            return self.__get_ragged_features(input_vecs)
         self.input_vecs = input_vecs
         self.model, self.encoder = self.__init_model(vecs_shape=self.input_vecs.shape)
         self.input_vecs = self.input_vecs.reshape((self.input_vecs.shape[0], self.input_vecs.shape[1]))
@@ -95,6 +222,15 @@ class DeepAutoencoder(Extractor):
         return autoencoder, encoder_model
 
 
+    def __get_ragged_features(self, sequences):
+        # Dense layers need the full width, but only one padded batch exists at a time
+        width = sequences.width
+        self.model, self.encoder = self.__init_model(vecs_shape=(len(sequences), width))
+        self.model.compile(optimizer='adadelta', loss='binary_crossentropy')
+        self.model.fit(RaggedBatches(sequences, self.batch_size, width=width), epochs=1000)
+        return predict_ragged(self.encoder, sequences, width)
+
+
     def __train(self, train):
         self.model.compile(optimizer='adadelta', loss='binary_crossentropy')
         self.model.fit(train, train, epochs=1000, batch_size=20, shuffle=True)
@@ -104,20 +240,55 @@ class DeepAutoencoder(Extractor):
 class DeepBeliefNetwork(Extractor):
     """ 
     A deep belief network for feature extraction
+    batch_size - rows passed through the trained network at once when extracting features
+    threads - torch intra-op threads used for training and extraction, None takes the
+    REPD_THREADS thread budget when it is set and otherwise keeps the current setting
     """
+    def __init__(self, batch_size=1024, threads=None):
+        super().__init__()
+        self.batch_size = batch_size
+        if threads is None and os.environ.get('REPD_THREADS'):
+            threads = int(os.environ['REPD_THREADS'])
+        self.threads = threads
+
     def get_features(self, input_vecs, label_vecs):
-        self.input_vecs = Variable(torch.from_numpy(input_vecs)).type(torch.FloatTensor)
         self.label_vecs = Variable(torch.from_numpy(label_vecs)).type(torch.FloatTensor)
-        self.visible_units = input_vecs.shape[1]
         self.hidden_units = [200, 100, 100]
+        ragged = isinstance(input_vecs, RaggedSequences)
+        if ragged:
+            self.input_vecs = input_vecs
+            self.visible_units = input_vecs.width
+        else:
+            self.input_vecs = Variable(torch.from_numpy(input_vecs)).type(torch.FloatTensor)
+            self.visible_units = input_vecs.shape[1]
         self.model = self.__init_model(self.visible_units, self.hidden_units)
-        self.__train(self.input_vecs, self.label_vecs)
-        representations = []
-        for inst in self.input_vecs:
-            reconstructed = inst.view(1, -1).type(torch.FloatTensor)
-            _, reconstructed = self.model.reconstruct(reconstructed)
-            representations.append(reconstructed)
-        representations = np.array([t.numpy() for t in representations])
+        previous_threads = torch.get_num_threads()
+        if self.threads is not None:
+            torch.set_num_threads(self.threads)
+        try:
+            if ragged:
+                self.__train_ragged(self.input_vecs, self.label_vecs)
+            else:
+                self.__train(self.input_vecs, self.label_vecs)
+            return self.__represent(self.input_vecs)
+        finally:
+            torch.set_num_threads(previous_threads)
+
+
+    def __batch(self, input_vecs, start):
+        if isinstance(input_vecs, RaggedSequences):
+            rows = np.arange(start, min(start+self.batch_size, len(input_vecs)))
+            return torch.from_numpy(input_vecs.dense(rows, self.visible_units))
+        return input_vecs[start:start+self.batch_size]
+
+
+    def __represent(self, input_vecs):
+        # Same (instances, 1, hidden) layout as the former one instance at a time extraction
+        representations = np.empty((len(input_vecs), 1, self.hidden_units[-1]), dtype=np.float32)
+        with torch.no_grad():
+            for start in range(0, len(input_vecs), self.batch_size):
+                _, hidden = self.model.reconstruct(self.__batch(input_vecs, start))
+                representations[start:start+hidden.shape[0], 0] = hidden.numpy()
         return representations
 
 
@@ -132,6 +303,29 @@ class DeepBeliefNetwork(Extractor):
         self.model.train_static(train, label, 1000, 20)
 
 
+    def __train_ragged(self, sequences, label):
+        """
+        DBN.train_static for RaggedSequences: the first RBM, whose visible layer has the full padded
+        width, trains on RaggedBatches so only one padded batch exists at a time. The narrow hidden
+        activations of the first RBM are then trained through train_static as before.
+        """
+        layers = self.model.rbm_layers
+        print("-"*20)
+        print("Training the 1 st rbm layer")
+        layers[0].train(TorchBatches(RaggedBatches(sequences, 20, width=self.visible_units)), 1000, 20)
+        hidden = []
+        with torch.no_grad():
+            for start in range(0, len(sequences), self.batch_size):
+                _, h = layers[0].forward(self.__batch(sequences, start))
+                hidden.append(h)
+        hidden = torch.cat(hidden)
+        for i in range(1, len(layers)):
+            print("-"*20)
+            print("Training the {} st rbm layer".format(i+1))
+            layers[i].train(torch.utils.data.DataLoader(torch.utils.data.TensorDataset(hidden, label), batch_size=20, drop_last=True), 1000, 20)
+            _, hidden = layers[i].forward(hidden)
+
+
 
 
     
@@ -0,0 +1,80 @@
+import numpy as np
+
+class RaggedSequences:
+    """
+    Token vectors of different lengths stored back to back (values) with row
+    boundaries (offsets), instead of one zero padded N*max_len matrix.
+    Rows are only padded when a batch of them is requested.
+    """
+    def __init__(self, values, offsets, align=8):
+        self.values = values
+        self.offsets = offsets
+        self.align = align
+
+    @classmethod
+    def from_lists(cls, data, align=8):
+        lengths = np.array([len(x) for x in data], dtype=np.int64)
+        offsets = np.zeros(len(lengths)+1, dtype=np.int64)
+        np.cumsum(lengths, out=offsets[1:])
+        values = np.concatenate([np.asarray(x).ravel() for x in data]) if len(data) else np.zeros(0)
+        return cls(values, offsets, align)
+
+    @classmethod
+    def load(cls, prefix, align=8):
+        """
+        Memory-maps <prefix>_values.npy and <prefix>_offsets.npy, e.g. as written by cpp_sequence_extractor
+        """
+        return cls(np.load(prefix+"_values.npy", mmap_mode='r'), np.load(prefix+"_offsets.npy"), align)
+
+    def __len__(self):
+        return len(self.offsets)-1
+
+    @property
+    def lengths(self):
+        return np.diff(self.offsets)
+
+    def padded_width(self, length):
+        """
+        Length rounded up to a multiple of align, as prepare_data pads
+        """
+        length = max(int(length), 1)
+        if length % self.align:
+            length += self.align - (length % self.align)
+        return length
+
+    @property
+    def width(self):
+        return self.padded_width(self.lengths.max() if len(self) else 0)
+
+    def dense(self, indices=None, width=None, dtype=np.float32):
+        """
+        Zero padded len(indices)*width matrix of the given rows, longer rows are truncated
+        """
+        if indices is None:
+            indices = np.arange(len(self))
+        if width is None:
+            width = self.width
+        indices = np.asarray(indices)
+        starts = self.offsets[indices]
+        lengths = np.minimum(self.offsets[indices+1]-starts, width)
+
+        out = np.zeros((len(indices), width), dtype=dtype)
+        rows = np.repeat(np.arange(len(indices)), lengths)
+        columns = np.arange(lengths.sum()) - np.repeat(np.cumsum(lengths)-lengths, lengths)
+        out[rows, columns] = self.values[np.repeat(starts, lengths) + columns]
+        return out
+
+    def to_dense(self, dtype=np.float32):
+        return self.dense(dtype=dtype)
+
+    def buckets(self, bucket_count=4):
+        """
+        Groups rows into at most bucket_count padded widths, chosen at length quantiles.
+        Returns a list of (width, row indices) pairs.
+        """
+        lengths = self.lengths
+        quantiles = np.quantile(lengths, np.linspace(0, 1, bucket_count+1)[1:]) if len(self) else []
+        widths = sorted(set(self.padded_width(q) for q in quantiles))
+        padded = np.array([self.padded_width(length) for length in lengths], dtype=np.int64)
+        bucket_of_row = np.searchsorted(widths, padded)
+        return [(width, np.flatnonzero(bucket_of_row == i)) for i, width in enumerate(widths) if np.any(bucket_of_row == i)]
@@ -1,33 +1,85 @@
 #determine the best distribution for the data- test if betta is really the best candidate
+import os
+import time
+from itertools import repeat
+from concurrent.futures import ProcessPoolExecutor
 import scipy.stats as st
-from numpy import std, mean, sqrt
+from numpy import std, mean, sqrt, isnan, random
 from scipy.stats import normaltest
 from scipy.stats import chisquare
 from scipy.stats import ttest_ind
+from instrumentation import timed
+from thread_budget import get_thread_budget, pool_initializer, worker_budget
 
 
-def get_best_distribution(data,print_info=False):
-    dist_names = ["norm", "exponweib", "weibull_max", "weibull_min", "pareto", "genextreme", 'gamma', 'beta', 'rayleigh', 'lognorm']
-    dist_results = []
-    params = {}
-    for dist_name in dist_names:
+DEFAULT_DIST_NAMES = ["norm", "exponweib", "weibull_max", "weibull_min", "pareto", "genextreme", 'gamma', 'beta', 'rayleigh', 'lognorm']
+
+@timed('stat.fit_distribution',rows_of=1)
+def fit_distribution(dist_name,data):
+    '''
+    Fits a single scipy distribution and applies the Kolmogorov-Smirnov test.
+    Returns (dist_name, param, p, seconds); a failed fit gets p = -1 so it is never selected.
+    '''
+    start = time.perf_counter()
+    try:
         dist = getattr(st, dist_name)
         param = dist.fit(data)
-
-        params[dist_name] = param
         # Applying the Kolmogorov-Smirnov test
         D, p = st.kstest(data, dist_name, args=param)
-        dist_results.append((dist_name, p))
+        if isnan(p):
+            p = -1
+    except Exception:
+        param, p = None, -1
+    return dist_name, param, p, time.perf_counter()-start
+
+def fit_distributions(dist_names,data,workers=1):
+    if workers is None or workers > 1:
+        #More processes than candidates would only idle, the budget is split between the processes started
+        if workers is None:
+            workers = get_thread_budget() or os.cpu_count() or 1
+        workers = max(1, min(workers, len(dist_names)))
+        threads = worker_budget(workers)
+        with ProcessPoolExecutor(max_workers=workers, initializer=pool_initializer, initargs=(threads,)) as executor:
+            return list(executor.map(fit_distribution, dist_names, repeat(data)))
+    return [fit_distribution(dist_name,data) for dist_name in dist_names]
+
+'''
+Selects the candidate distribution with the highest Kolmogorov-Smirnov p value.
+
+dist_names - candidate scipy.stats distribution names
+workers - number of processes fitting candidates concurrently, None uses all cores (or the thread budget), at most one per candidate
+screen_size - when the data is larger, every candidate is first fitted on a random subsample
+of this size and only the screen_keep best candidates are fitted on the full data
+return_details - additionally return a list of (dist_name, param, p, seconds) for every fit
+Raises ValueError naming the candidates when none of them could be fitted.
+'''
+@timed('stat.best_distribution',rows_of=0)
+def get_best_distribution(data,print_info=False,dist_names=DEFAULT_DIST_NAMES,workers=1,screen_size=None,screen_keep=3,return_details=False):
+    details = []
+    if screen_size is not None and len(data) > screen_size and len(dist_names) > screen_keep:
+        sample = random.default_rng(0).choice(data, size=screen_size, replace=False)
+        screen_results = fit_distributions(dist_names, sample, workers)
+        details.extend(("screen:"+name, param, p, seconds) for name, param, p, seconds in screen_results)
+        # drop hopeless candidates before the expensive full data fit
+        screen_results.sort(key=lambda item: item[2], reverse=True)
+        dist_names = [name for name, _, _, _ in screen_results[:screen_keep]]
+
+    dist_results = fit_distributions(dist_names, data, workers)
+    details.extend(dist_results)
 
     # select the best fitted distribution
-    best_dist, best_p = (max(dist_results, key=lambda item: item[1]))
+    best_dist, best_param, best_p, _ = max(dist_results, key=lambda item: item[2])
+    if best_p < 0:
+        raise ValueError("no candidate distribution could be fitted to "+str(len(data))+" values, failed: "+", ".join(dist_names))
     # store the name of the best fit and its p value
     
     if print_info:
         print("Best fitting distribution: "+str(best_dist))
-        print("Parameters for the best fit: "+ str(params[best_dist]))
+        print("Parameters for the best fit: "+ str(best_param))
 
-    return best_dist, params[best_dist]
+    if return_details:
+        return best_dist, best_param, details
+    return best_dist, best_param
 
 def cohen_d(x,y):
     nx = len(x)
@@ -45,6 +97,8 @@ def get_cohen_d_interpretation(d_value,trivial_bound=0.2,small_bound=0.5,moderat
     else:
         return "large"
 
+#result_analysis computes the tests below for all models, datasets and measures at once, for large result sets
+
 '''
 Method assumes there is a column Model which model specific data can be identified by. 
 measure - indicates the column name of the performance whose samples we wish to test
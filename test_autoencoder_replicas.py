@@ -0,0 +1,33 @@
+import unittest
+
+import numpy as np
+
+try:
+    import tensorflow
+except ImportError:
+    tensorflow = None
+
+@unittest.skipIf(tensorflow is None, "needs tensorflow")
+class AutoEncoderReplicasTest(unittest.TestCase):
+
+    def test_replica_shorter_than_a_batch_stays_finite(self):
+        from autoencoder_replicas import AutoEncoderReplicas
+
+        rng = np.random.RandomState(0)
+        #The first replica never fills a batch, the second needs two batches of which the last is short
+        datasets = [rng.rand(10, 21), rng.rand(600, 21)]
+        replicas = AutoEncoderReplicas(2, [21, 10], epoch=3, batch_size=512)
+        try:
+            initial = replicas.sess.run(replicas.W)
+            replicas.fit(datasets)
+            W, b, c = replicas.sess.run([replicas.W, replicas.b, replicas.c])
+        finally:
+            replicas.close()
+
+        for values in W+b+c:
+            self.assertTrue(np.all(np.isfinite(values)))
+        for before, after in zip(initial, W):
+            self.assertFalse(np.allclose(before[0], after[0]))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,39 @@
+import unittest
+
+from function_segments import split_functions
+
+def span_names(source):
+    _, spans = split_functions(source)
+    return [(span.name, span.start_line, span.end_line) for span in spans]
+
+class FindFunctionSpansTest(unittest.TestCase):
+
+    def test_lambda_member_initializer_is_not_a_function(self):
+        source = (
+            "class Widget {\n"
+            "public:\n"
+            "    std::function<void()> on_click = [](){ return; };\n"
+            "    void (*callback)(int) = nullptr;\n"
+            "    int size() const { return 1; }\n"
+            "};\n"
+            "auto twice = [](int x) { return x+x; };\n"
+            "int main() { return 0; }\n")
+        self.assertEqual(span_names(source), [('size', 5, 5), ('main', 8, 8)])
+
+    def test_template_parentheses_are_not_the_parameter_list(self):
+        source = "std::function<int(int)> make_handler(int base) {\n    return [base](int x){ return base+x; };\n}\n"
+        self.assertEqual(span_names(source), [('make_handler', 1, 3)])
+
+    def test_assignments_inside_the_parameter_list_and_operators(self):
+        source = (
+            "struct Widget {\n"
+            "    Widget(int a = 0, int b = 1) : a_(a), b_{b} { a_ += b; }\n"
+            "    Widget& operator=(const Widget& other) { a_ = other.a_; return *this; }\n"
+            "    bool operator<(const Widget& other) const { return a_ < other.a_; }\n"
+            "    int a_, b_;\n"
+            "};\n"
+            "template<typename T, typename = void> T twice(T x) { return x+x; }\n")
+        self.assertEqual(span_names(source), [('Widget', 2, 2), ('operator=', 3, 3), ('operator<', 4, 4), ('twice', 7, 7)])
+
+if __name__ == '__main__':
+    unittest.main()
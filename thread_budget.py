@@ -0,0 +1,88 @@
+"""
+One CPU thread budget for every runtime used by the pipeline.
+
+set_thread_budget(n) limits the current process to n threads in
+TensorFlow (through session_config(), used by every AutoEncoder session),
+PyTorch, scikit-learn/joblib (sklearn_jobs()) and the BLAS/OpenMP pools of
+NumPy and SciPy. The budget can also be given for a whole run with the
+environment variable REPD_THREADS.
+
+Environment variables only reach BLAS libraries that are loaded afterwards;
+pools that are already loaded are limited with threadpoolctl when it is
+installed (it ships with scikit-learn). Parallel runners hand every worker
+process worker_budget(workers) threads through pool_initializer.
+"""
+import os
+import sys
+
+# Read by OpenMP, the BLAS builds used by NumPy/SciPy, numexpr and TensorFlow on start
+THREAD_ENVIRONMENT_VARIABLES = [
+    'OMP_NUM_THREADS', 'OPENBLAS_NUM_THREADS', 'MKL_NUM_THREADS', 'BLIS_NUM_THREADS',
+    'VECLIB_MAXIMUM_THREADS', 'NUMEXPR_NUM_THREADS', 'TF_NUM_INTRAOP_THREADS'
+]
+
+_threads = None
+_blas_limits = None
+
+def get_thread_budget():
+    '''
+    Threads this process may use, None when no budget is set
+    '''
+    return _threads
+
+def set_thread_budget(threads):
+    '''
+    Limits TensorFlow, PyTorch, scikit-learn and BLAS of this process to threads threads, None removes the budget
+    '''
+    global _threads, _blas_limits
+    _threads = None if threads is None else max(1, int(threads))
+    if _threads is None:
+        return None
+
+    for name in THREAD_ENVIRONMENT_VARIABLES:
+        os.environ[name] = str(_threads)
+    os.environ['TF_NUM_INTEROP_THREADS'] = str(min(2, _threads))
+
+    try:
+        from threadpoolctl import threadpool_limits
+        _blas_limits = threadpool_limits(limits=_threads)
+    except ImportError:
+        pass
+
+    #Only runtimes that are already imported are configured here, the others read the environment
+    if 'torch' in sys.modules:
+        torch = sys.modules['torch']
+        torch.set_num_threads(_threads)
+    return _threads
+
+def worker_budget(workers, cpus=None):
+    '''
+    Threads of each of workers processes sharing cpus cores (all cores by default)
+    '''
+    if cpus is None:
+        cpus = _threads or os.cpu_count() or 1
+    return max(1, cpus//max(1, workers))
+
+def pool_initializer(threads):
+    '''
+    Initializer for multiprocessing and concurrent.futures pools: Pool(workers, pool_initializer, (threads,))
+    '''
+    set_thread_budget(threads)
+
+def session_config():
+    '''
+    tf.ConfigProto with the budget as intra-op threads, None without a budget (TensorFlow defaults)
+    '''
+    if _threads is None:
+        return None
+    import tensorflow.compat.v1 as tf
+    return tf.ConfigProto(intra_op_parallelism_threads=_threads, inter_op_parallelism_threads=min(2, _threads))
+
+def sklearn_jobs(default=-1):
+    '''
+    n_jobs for scikit-learn estimators and joblib, the budget or default without one
+    '''
+    return default if _threads is None else _threads
+
+if os.environ.get('REPD_THREADS'):
+    set_thread_budget(int(os.environ['REPD_THREADS']))